@@ -13,6 +13,7 @@
 #include <random>
 #include <algorithm>
 #include <atomic>
+#include <functional>
 #include <string>
 #include <regex>
 #include <complex> // Used in a previous version, kept for potential future use
@@ -102,7 +103,7 @@ namespace RayTracer {
         auto start = std::chrono::high_resolution_clock::now();
 
         for (int y = 0; y < HEIGHT; ++y) {
-            pool.enqueue([&, y]() {
+            pool.post([&, y]() {
                 for (int x = 0; x < WIDTH; ++x) {
                     double fov = 1.0;
                     double dir_x = (x + 0.5) - WIDTH / 2.0;
@@ -153,7 +154,7 @@ namespace ParallelSort {
         LockFreeThreadPool pool;
         auto start = std::chrono::high_resolution_clock::now();
 
-        std::vector<std::future<void>> sort_futures;
+        std::vector<TaskFuture<void>> sort_futures;
         for (size_t i = 0; i < ARRAY_SIZE; i += CHUNK_SIZE) {
             sort_futures.push_back(pool.enqueue([&data, i, CHUNK_SIZE]() {
                 size_t end = std::min(i + CHUNK_SIZE, data.size());
@@ -201,24 +202,20 @@ namespace MonteCarloPi {
     void run() {
         std::cout << "\n--- 3. Monte Carlo Pi Solver ---" << std::endl;
         const long long TOTAL_POINTS = 100'000'000;
-        const int NUM_TASKS = 100;
-        const long long POINTS_PER_TASK = TOTAL_POINTS / NUM_TASKS;
+        const long long POINTS_PER_BATCH = 10'000;
+        const long long NUM_BATCHES = TOTAL_POINTS / POINTS_PER_BATCH;
 
         LockFreeThreadPool pool;
-        std::atomic<long long> total_hits{0};
-        std::vector<std::future<void>> futures;
 
         auto start = std::chrono::high_resolution_clock::now();
 
-        for (int i = 0; i < NUM_TASKS; ++i) {
-            futures.push_back(pool.enqueue([&total_hits, POINTS_PER_TASK]() {
-                long long hits = calculate_hits_in_circle(POINTS_PER_TASK);
-                total_hits.fetch_add(hits, std::memory_order_relaxed);
-            }));
-        }
-        for(auto& f : futures) f.get();
+        // Each worker sums its batches locally; the partial sums are only
+        // combined once at the end, so fine batches cost no contention.
+        long long total_hits = pool.parallel_reduce(0LL, NUM_BATCHES, 0LL,
+            [POINTS_PER_BATCH](long long) { return calculate_hits_in_circle(POINTS_PER_BATCH); },
+            std::plus<long long>());
 
-        double pi_estimate = 4.0 * total_hits.load() / TOTAL_POINTS;
+        double pi_estimate = 4.0 * total_hits / TOTAL_POINTS;
 
         auto end = std::chrono::high_resolution_clock::now();
         std::cout << "Pi calculation finished in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms." << std::endl;
@@ -262,32 +259,17 @@ namespace RegexGrep {
         }
 
         const std::regex search_regex("important_data_packet");
-        const size_t CHUNK_SIZE = 100000;
         LockFreeThreadPool pool;
-        std::atomic<int> match_count{0};
-        std::vector<std::future<void>> futures;
 
         auto start = std::chrono::high_resolution_clock::now();
 
-        for (size_t i = 0; i < lines.size(); i += CHUNK_SIZE) {
-            futures.push_back(pool.enqueue([&, i, CHUNK_SIZE, &search_regex]() {
-                int local_matches = 0;
-                size_t end = std::min(i + CHUNK_SIZE, lines.size());
-                for (size_t j = i; j < end; ++j) {
-                    if (std::regex_search(lines[j], search_regex)) {
-                        local_matches++;
-                    }
-                }
-                if (local_matches > 0) {
-                    match_count.fetch_add(local_matches, std::memory_order_relaxed);
-                }
-            }));
-        }
-        for(auto& f : futures) f.get();
+        int match_count = pool.parallel_reduce(size_t{0}, lines.size(), 0,
+            [&lines, &search_regex](size_t j) { return std::regex_search(lines[j], search_regex) ? 1 : 0; },
+            std::plus<int>());
 
         auto end = std::chrono::high_resolution_clock::now();
         std::cout << "Search finished in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms." << std::endl;
-        std::cout << "Number of matches found: " << match_count.load() << std::endl;
+        std::cout << "Number of matches found: " << match_count << std::endl;
     }
 } // namespace RegexGrep
 
@@ -23,297 +23,4176 @@ claim, damages, or other liability arising from the use of this software.
 #include <chrono>
 #include <cstddef>
 #include <utility>
+#include <tuple>
+#include <type_traits>
 #include <new>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <iterator>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <fstream>
 
-template<typename T, size_t Size>
-class LockFreeRingBuffer {
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+// Minimal futex wrapper over a 32-bit atomic word. On Linux this is the real
+// syscall; elsewhere it falls back to a small table of mutex/condvar buckets
+// keyed by address. wait() may return spuriously, callers must re-check.
+class Futex {
 private:
-    struct alignas(64) Node {
-        std::atomic<T*> data{nullptr};
-        char padding[64 - sizeof(std::atomic<T*>)];
+#if !defined(__linux__)
+    struct Bucket {
+        std::mutex mutex;
+        std::condition_variable cv;
     };
 
-    alignas(64) std::atomic<size_t> head{0};
-    alignas(64) std::atomic<size_t> tail{0};
-    std::array<Node, Size> buffer;
+    static Bucket& bucket_for(const void* address) {
+        static Bucket buckets[64];
+        auto key = reinterpret_cast<std::uintptr_t>(address);
+        return buckets[(key >> 4) % 64];
+    }
+#endif
+
+public:
+    static void wait(std::atomic<uint32_t>& word, uint32_t expected) {
+#if defined(__linux__)
+        static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be 32 bits");
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE,
+                expected, nullptr, nullptr, 0);
+#else
+        Bucket& bucket = bucket_for(&word);
+        std::unique_lock<std::mutex> lock(bucket.mutex);
+        while (word.load(std::memory_order_acquire) == expected) {
+            bucket.cv.wait(lock);
+        }
+#endif
+    }
+
+    // Like wait(), but gives up after roughly timeout.
+    static void wait_for(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::nanoseconds timeout) {
+        if (timeout.count() <= 0) {
+            return;
+        }
+#if defined(__linux__)
+        timespec relative{};
+        relative.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+        relative.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE,
+                expected, &relative, nullptr, 0);
+#else
+        Bucket& bucket = bucket_for(&word);
+        std::unique_lock<std::mutex> lock(bucket.mutex);
+        bucket.cv.wait_for(lock, timeout, [&]() { return word.load(std::memory_order_acquire) != expected; });
+#endif
+    }
+
+    static void wake(std::atomic<uint32_t>& word, int count) {
+#if defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE,
+                count, nullptr, nullptr, 0);
+#else
+        (void)count;
+        Bucket& bucket = bucket_for(&word);
+        { std::lock_guard<std::mutex> lock(bucket.mutex); }
+        bucket.cv.notify_all();
+#endif
+    }
+};
+
+// Eventcount: lets a thread park on "nothing to do" without losing a wake-up
+// that races with its last check. Usage:
+//     auto key = ec.prepare_wait();
+//     if (condition) { ec.cancel_wait(); } else { ec.commit_wait(key); }
+// Notifiers publish their state change first, then call notify_*(). When no
+// one is waiting, notify costs a fence and a load.
+class EventCount {
+private:
+    alignas(64) std::atomic<uint32_t> epoch{0};
+    std::atomic<uint32_t> waiters{0};
 
-    static constexpr size_t MASK = Size - 1;
-    static_assert((Size & (Size - 1)) == 0, "Size must be power of 2");
+    void notify(int count) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        epoch.fetch_add(1, std::memory_order_seq_cst);
+        Futex::wake(epoch, count);
+    }
 
 public:
-    bool push(T* item) {
-        size_t current_tail = tail.load(std::memory_order_relaxed);
-        size_t next_tail = (current_tail + 1) & MASK;
+    uint32_t prepare_wait() {
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        uint32_t key = epoch.load(std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return key;
+    }
 
-        if (next_tail == head.load(std::memory_order_acquire)) {
-            return false;
+    void cancel_wait() {
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void commit_wait(uint32_t key) {
+        while (epoch.load(std::memory_order_acquire) == key) {
+            Futex::wait(epoch, key);
         }
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
 
-        buffer[current_tail].data.store(item, std::memory_order_release);
-        tail.store(next_tail, std::memory_order_release);
-        return true;
+    // Like commit_wait(), but returns after timeout even without a notify.
+    void commit_wait_for(uint32_t key, std::chrono::nanoseconds timeout) {
+        if (epoch.load(std::memory_order_acquire) == key) {
+            Futex::wait_for(epoch, key, timeout);
+        }
+        waiters.fetch_sub(1, std::memory_order_relaxed);
     }
 
-    T* pop() {
-        while (true) {
-            size_t current_head = head.load(std::memory_order_relaxed);
-            size_t current_tail = tail.load(std::memory_order_acquire);
+    void notify_one() {
+        notify(1);
+    }
 
-            if (current_head == current_tail) {
-                return nullptr;
-            }
+    void notify_all() {
+        notify(std::numeric_limits<int>::max());
+    }
+
+    void notify_many(size_t count) {
+        notify(static_cast<int>(std::min<size_t>(count, std::numeric_limits<int>::max())));
+    }
 
-            size_t next_head = (current_head + 1) & MASK;
-            if (head.compare_exchange_weak(current_head, next_head,
-                                           std::memory_order_release,
-                                           std::memory_order_relaxed)) {
-                return buffer[current_head].data.load(std::memory_order_acquire);
-                                            }
+    uint32_t waiting() const {
+        return waiters.load(std::memory_order_relaxed);
+    }
+};
+
+// EventCount that other threads may pin: whoever completes what a parked
+// helper waits for notifies it, and may still be doing so once the owner
+// has released its reference.
+class SharedEventCount : public EventCount {
+private:
+    std::atomic<uint32_t> refs{1};
+
+public:
+    void add_ref() {
+        refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
         }
     }
+};
 
-    T* steal() {
-        while (true) {
-            size_t current_head = head.load(std::memory_order_relaxed);
-            size_t current_tail = tail.load(std::memory_order_acquire);
+// Where a pool worker that runs tasks while it waits (instead of blocking)
+// parks: its pool's event count, published next to a HELPER bit in the
+// awaited object's state word. The completer pins the event count before
+// it changes the word, since the waiter may free the object right after,
+// and notifies it afterwards. One helper at a time; others fall back to
+// timed naps.
+class HelperSlot {
+private:
+    std::atomic<SharedEventCount*> parked{nullptr};
 
-            if (current_head == current_tail) {
-                return nullptr;
+public:
+    // Helper side, after prepare_wait() on sleepers. Returns false if the
+    // slot is already another pool's.
+    bool arm(std::atomic<uint32_t>& word, uint32_t helper_bit, SharedEventCount& sleepers) {
+        SharedEventCount* expected = nullptr;
+        if (!parked.compare_exchange_strong(expected, &sleepers, std::memory_order_release) &&
+            expected != &sleepers) {
+            return false;
+        }
+        word.fetch_or(helper_bit, std::memory_order_acq_rel);
+        return true;
+    }
+
+    // Completer side: replaces the word's value v by next(v) and returns v.
+    // If v has helper_bit, wake holds the pinned event count for notify().
+    template<typename Next>
+    uint32_t update(std::atomic<uint32_t>& word, uint32_t helper_bit, Next next, SharedEventCount*& wake) {
+        uint32_t current = word.load(std::memory_order_acquire);
+        while (true) {
+            wake = current & helper_bit ? parked.load(std::memory_order_acquire) : nullptr;
+            if (wake) {
+                wake->add_ref();
             }
+            if (word.compare_exchange_weak(current, next(current), std::memory_order_acq_rel,
+                                           std::memory_order_acquire)) {
+                return current;
+            }
+            if (wake) {
+                wake->release();
+            }
+        }
+    }
 
-            size_t next_head = (current_head + 1) & MASK;
-            if (head.compare_exchange_weak(current_head, next_head,
-                                            std::memory_order_release,
-                                            std::memory_order_relaxed)) {
-                return buffer[current_head].data.load(std::memory_order_acquire);
-                                             }
+    // Drops a pin from update(), waking the helper first if woken.
+    static void notify(SharedEventCount* wake, bool woken = true) {
+        if (wake) {
+            if (woken) {
+                wake->notify_all();
+            }
+            wake->release();
         }
     }
 
-    bool empty() const {
-        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    // Owner side, once nothing can complete it any more.
+    void reset() {
+        parked.store(nullptr, std::memory_order_relaxed);
     }
 };
 
-class LockFreeThreadPool {
+// Countdown latch over a futex word. Participants may add to the count while
+// they still hold a part of it; wait() returns once it reaches zero. The
+// final count_down() only enters the kernel if someone is asleep, and after
+// its exchange it no longer reads the latch, so it may live on the waiter's
+// stack.
+class Latch {
 private:
-    struct Task {
-        std::function<void()> func;
-        Task* next{nullptr};
-    };
+    static constexpr uint32_t READY = 1;
+    static constexpr uint32_t WAITING = 2;
+    static constexpr uint32_t HELPER = 4;
 
-    struct alignas(64) WorkerData {
-        LockFreeRingBuffer<Task, 4096> local_queue;
-        std::atomic<bool> sleeping{false};
-        std::atomic<size_t> steal_attempts{0};
-        char padding[64 - sizeof(std::atomic<bool>) - sizeof(std::atomic<size_t>)];
-    };
+    std::atomic<size_t> count;
+    std::atomic<uint32_t> state;
+    HelperSlot helper;
 
-    std::vector<std::thread> threads;
-    std::vector<std::unique_ptr<WorkerData>> worker_data;
-    std::atomic<bool> stop{false};
-    std::atomic<size_t> active_tasks{0};
-    std::atomic<size_t> global_queue_size{0};
+public:
+    explicit Latch(size_t initial) : count(initial), state(initial == 0 ? READY : 0) {}
 
-    alignas(64) std::atomic<Task*> global_queue_head{nullptr};
-    alignas(64) std::atomic<size_t> task_counter{0};
+    Latch(const Latch&) = delete;
+    Latch& operator=(const Latch&) = delete;
 
-    static thread_local size_t& get_thread_id() {
-        static thread_local size_t id_val = std::numeric_limits<size_t>::max();
-        return id_val;
+    void count_up(size_t n = 1) {
+        count.fetch_add(n, std::memory_order_relaxed);
     }
 
-    static thread_local std::mt19937& get_thread_rng() {
-        static thread_local std::mt19937 rng_val{std::random_device{}()};
-        return rng_val;
+    void count_down() {
+        if (count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            SharedEventCount* wake;
+            uint32_t previous = helper.update(state, HELPER, [](uint32_t) { return READY; }, wake);
+            if (previous & WAITING) {
+                Futex::wake(state, std::numeric_limits<int>::max());
+            }
+            HelperSlot::notify(wake);
+        }
     }
 
-    void worker_thread(size_t id) {
-        get_thread_id() = id;
-        auto& data = *worker_data[id];
-
-        while (!stop.load(std::memory_order_relaxed)) {
-            Task* task = nullptr;
+    bool try_wait() const {
+        return state.load(std::memory_order_acquire) & READY;
+    }
 
-            task = data.local_queue.pop();
+    // For a pool worker about to park on sleepers while it waits here.
+    bool add_helper(SharedEventCount& sleepers) {
+        return helper.arm(state, HELPER, sleepers);
+    }
 
-            if (!task) {
-                task = steal_from_global();
+    void wait() {
+        uint32_t current = state.load(std::memory_order_acquire);
+        while (!(current & READY)) {
+            if (!(current & WAITING) &&
+                !state.compare_exchange_weak(current, current | WAITING, std::memory_order_acquire)) {
+                continue;
             }
+            Futex::wait(state, current | WAITING);
+            current = state.load(std::memory_order_acquire);
+        }
+    }
+};
 
-            if (!task) {
-                task = steal_from_others(id);
+// Slots are plain pointers packed eight to a cache line; only top and bottom
+// get lines of their own. Owner and thieves touch the same slot line only
+// when the deque is nearly empty, and then they already contend on top.
+//
+// A growable deque doubles into a new array when the owner pushes onto a full
+// one. A thief may still be reading the old array, so it is kept, chained
+// from the new one, until the deque is destroyed; the retired arrays add up to
+// less than the live one.
+template<typename T>
+class WorkStealingDeque {
+private:
+    struct Array {
+        explicit Array(std::unique_ptr<std::atomic<T*>[]> storage, size_t capacity)
+            : slots(std::move(storage)), mask(static_cast<std::ptrdiff_t>(capacity) - 1) {}
+
+        std::unique_ptr<std::atomic<T*>[]> slots;
+        const std::ptrdiff_t mask;
+        std::unique_ptr<Array> retired;
+
+        T* get(std::ptrdiff_t i) const {
+            return slots[i & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(std::ptrdiff_t i, T* item) {
+            slots[i & mask].store(item, std::memory_order_relaxed);
+        }
+
+        std::ptrdiff_t capacity() const {
+            return mask + 1;
+        }
+    };
+
+    std::atomic<Array*> array;
+    const bool growable;
+
+    alignas(64) std::atomic<std::ptrdiff_t> top{0};
+    alignas(64) std::atomic<std::ptrdiff_t> bottom{0};
+
+    static size_t round_up(size_t count) {
+        size_t rounded = 1;
+        while (rounded < count) {
+            rounded <<= 1;
+        }
+        return rounded;
+    }
+
+    // Takes the item at top with one CAS, retrying when another thief or
+    // the owner's last-item pop wins; rounds counts the CAS attempts.
+    T* claim(size_t& rounds) {
+        while (true) {
+            std::ptrdiff_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::ptrdiff_t b = bottom.load(std::memory_order_acquire);
+
+            if (t >= b) {
+                return nullptr;
             }
 
-            if (task) {
-                active_tasks.fetch_add(1, std::memory_order_relaxed);
-                task->func();
-                active_tasks.fetch_sub(1, std::memory_order_relaxed);
-                delete task;
-                data.steal_attempts.store(0, std::memory_order_relaxed);
-            } else {
-                backoff(data);
+            // Loaded after bottom, so it is at least the array b was
+            // published in; an older array still holds the same items.
+            T* item = array.load(std::memory_order_acquire)->get(t);
+            ++rounds;
+            if (top.compare_exchange_strong(t, t + 1,
+                                            std::memory_order_seq_cst,
+                                            std::memory_order_relaxed)) {
+                return item;
             }
         }
     }
 
-    Task* steal_from_global() {
-        Task* head = global_queue_head.load(std::memory_order_acquire);
-        while (head) {
-            Task* next = head->next;
-            if (global_queue_head.compare_exchange_weak(head, next,
-                                                        std::memory_order_release,
-                                                        std::memory_order_acquire)) {
-                global_queue_size.fetch_sub(1, std::memory_order_relaxed);
-                return head;
-            }
+    // Owner only, when current cannot take needed more items after [t, b).
+    // Returns a larger array holding [t, b), or nullptr if the deque is fixed
+    // or the allocation fails.
+    Array* grow(Array* current, std::ptrdiff_t t, std::ptrdiff_t b, std::ptrdiff_t needed) {
+        if (!growable) {
+            return nullptr;
         }
-        return nullptr;
+
+        size_t capacity = round_up(static_cast<size_t>(b - t + needed));
+        std::unique_ptr<std::atomic<T*>[]> storage(new (std::nothrow) std::atomic<T*>[capacity]);
+        std::unique_ptr<Array> grown(storage ? new (std::nothrow) Array(std::move(storage), capacity) : nullptr);
+        if (!grown) {
+            return nullptr;
+        }
+        for (std::ptrdiff_t i = t; i < b; ++i) {
+            grown->put(i, current->get(i));
+        }
+        grown->retired.reset(current);
+        Array* published = grown.release();
+        array.store(published, std::memory_order_release);
+        return published;
     }
 
-    Task* steal_from_others(size_t thief_id) {
-        size_t victim_count = worker_data.size();
-        std::uniform_int_distribution<size_t> dist(0, victim_count - 1);
+public:
+    // The capacity is min_capacity rounded up to a power of two. A full fixed
+    // deque rejects pushes; a growable one doubles as needed.
+    explicit WorkStealingDeque(size_t min_capacity = 4096, bool growable = false)
+        : array(new Array(std::make_unique<std::atomic<T*>[]>(round_up(min_capacity)), round_up(min_capacity))),
+          growable(growable) {}
 
-        for (size_t attempts = 0; attempts < victim_count * 2; ++attempts) {
-            size_t victim_id = dist(get_thread_rng());
-            if (victim_id == thief_id) continue;
+    ~WorkStealingDeque() {
+        delete array.load(std::memory_order_relaxed);
+    }
 
-            Task* task = worker_data[victim_id]->local_queue.steal();
-            if (task) return task;
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner only. Chase-Lev deque: the owner pushes and pops at the bottom
+    // without a CAS; thieves take from the top and only race the owner for
+    // the very last element.
+    bool push(T* item) {
+        std::ptrdiff_t b = bottom.load(std::memory_order_relaxed);
+        std::ptrdiff_t t = top.load(std::memory_order_acquire);
+
+        Array* target = array.load(std::memory_order_relaxed);
+        if (b - t >= target->capacity() && !(target = grow(target, t, b, 1))) {
+            return false;
         }
 
-        return nullptr;
+        target->put(b, item);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
     }
 
-    void backoff(WorkerData& data) {
-        size_t attempts = data.steal_attempts.fetch_add(1, std::memory_order_relaxed);
+    // Owner only. Pushes as many of items as fit and publishes them with a
+    // single bottom store; returns how many were pushed.
+    size_t push_bulk(T* const* items, size_t count) {
+        std::ptrdiff_t b = bottom.load(std::memory_order_relaxed);
+        std::ptrdiff_t t = top.load(std::memory_order_acquire);
 
-        if (attempts < 10) {
-            std::this_thread::yield();
-        } else if (attempts < 20) {
-            std::this_thread::sleep_for(std::chrono::microseconds(10));
-        } else if (attempts < 100) {
-            std::this_thread::sleep_for(std::chrono::microseconds(100));
-        } else {
-            data.sleeping.store(true, std::memory_order_release);
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            data.sleeping.store(false, std::memory_order_release);
+        Array* target = array.load(std::memory_order_relaxed);
+        auto needed = static_cast<std::ptrdiff_t>(count);
+        if (b - t + needed > target->capacity()) {
+            if (Array* grown = grow(target, t, b, needed)) {
+                target = grown;
+            } else {
+                count = static_cast<size_t>(target->capacity() - (b - t));
+            }
         }
+        for (size_t i = 0; i < count; ++i) {
+            target->put(b + static_cast<std::ptrdiff_t>(i), items[i]);
+        }
+        bottom.store(b + static_cast<std::ptrdiff_t>(count), std::memory_order_release);
+        return count;
     }
 
-    void wake_sleeping_thread() {
-        for (auto& data : worker_data) {
-            if (data->sleeping.load(std::memory_order_acquire)) {
-                data->steal_attempts.store(0, std::memory_order_relaxed);
-                break;
+    // Owner only, LIFO.
+    T* pop() {
+        std::ptrdiff_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::ptrdiff_t t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        T* item = array.load(std::memory_order_relaxed)->get(b);
+        if (t == b) {
+            if (!top.compare_exchange_strong(t, t + 1,
+                                             std::memory_order_seq_cst,
+                                             std::memory_order_relaxed)) {
+                item = nullptr;
             }
+            bottom.store(b + 1, std::memory_order_relaxed);
         }
+        return item;
     }
 
-public:
-    explicit LockFreeThreadPool(size_t num_threads = std::thread::hardware_concurrency()) {
-        worker_data.reserve(num_threads);
-        threads.reserve(num_threads);
+    // Any thread, FIFO.
+    T* steal() {
+        size_t rounds = 0;
+        return claim(rounds);
+    }
 
-        for (size_t i = 0; i < num_threads; ++i) {
-            worker_data.emplace_back(std::make_unique<WorkerData>());
+    // Called by the owner of into. Takes up to half of this deque's items,
+    // oldest first: the first is returned, the rest are pushed onto into.
+    // This is not a single batch claim: each item still costs its own CAS on
+    // top, because moving top past several at once could overtake the owner,
+    // whose pops only CAS on the last item. What a batch saves is the thief's
+    // repeated searches and victim picks. If cas_rounds is given, the CAS
+    // round trips spent, failed ones included, are added to it.
+    T* steal_half(WorkStealingDeque& into, size_t* cas_rounds = nullptr) {
+        size_t rounds = 0;
+        T* first = claim(rounds);
+        if (first) {
+            // into only shrinks meanwhile, so its free room only grows.
+            size_t room = into.capacity() - into.size();
+            size_t batch = std::min(size() / 2, room);
+            for (size_t i = 0; i < batch; ++i) {
+                T* item = claim(rounds);
+                if (!item) {
+                    break;
+                }
+                into.push(item);
+            }
+        }
+        if (cas_rounds) {
+            *cas_rounds += rounds;
         }
+        return first;
+    }
 
-        for (size_t i = 0; i < num_threads; ++i) {
-            threads.emplace_back(&LockFreeThreadPool::worker_thread, this, i);
+    bool empty() const {
+        std::ptrdiff_t t = top.load(std::memory_order_acquire);
+        std::ptrdiff_t b = bottom.load(std::memory_order_acquire);
+        return b <= t;
+    }
+
+    // Slots in the current array; a growable deque may hold more later.
+    size_t capacity() const {
+        return static_cast<size_t>(array.load(std::memory_order_acquire)->capacity());
+    }
+
+    size_t size() const {
+        std::ptrdiff_t t = top.load(std::memory_order_acquire);
+        std::ptrdiff_t b = bottom.load(std::memory_order_acquire);
+        return b > t ? static_cast<size_t>(b - t) : 0;
+    }
+
+    // Owner only. Pushes the deque is sure to accept; thieves can only add
+    // room. Unbounded for a growable deque, short of running out of memory.
+    size_t room() const {
+        if (growable) {
+            return std::numeric_limits<size_t>::max();
         }
+        size_t used = size();
+        size_t slots = capacity();
+        return used < slots ? slots - used : 0;
     }
+};
 
-    ~LockFreeThreadPool() {
-        wait();
+// Multi-producer multi-consumer FIFO used for tasks submitted from outside
+// the pool. The fast path is a bounded array of sequenced cells (Vyukov); a
+// consumer claims a whole run of ready cells with a single CAS. When the ring
+// is full, producers append to an intrusive overflow list (T needs a `next`
+// member) and keep doing so until it drains, which preserves FIFO order.
+template<typename T>
+class InjectionQueue {
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T* data;
+    };
 
-        stop.store(true, std::memory_order_release);
+    std::unique_ptr<Cell[]> cells;
+    const size_t capacity;
+    const size_t mask;
 
-        for (auto& thread : threads) {
-            if (thread.joinable()) {
-                thread.join();
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+
+    alignas(64) std::mutex overflow_mutex;
+    T* overflow_head{nullptr};
+    T* overflow_tail{nullptr};
+    std::atomic<size_t> overflow_size{0};
+
+    bool try_push(T* item) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
             }
         }
 
-        Task* head = global_queue_head.load(std::memory_order_acquire);
-        while (head) {
-            Task* next = head->next;
-            delete head;
-            head = next;
-        }
+        cell->data = item;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
     }
 
-    template<typename F, typename... Args>
-    auto enqueue(F&& f, Args&&... args) -> std::future<typename std::invoke_result<F, Args...>::type> {
-        using return_type = typename std::invoke_result<F, Args...>::type;
+    // Claims runs of free cells with one CAS each (normally a single run) and
+    // returns how many of items made it into the ring before it filled up.
+    size_t try_push_bulk(T* const* items, size_t count) {
+        size_t pushed = 0;
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        while (pushed < count) {
+            size_t free_cells = 0;
+            while (pushed + free_cells < count) {
+                size_t seq = cells[(pos + free_cells) & mask].sequence.load(std::memory_order_acquire);
+                if (seq != pos + free_cells) {
+                    break;
+                }
+                ++free_cells;
+            }
 
-        auto promise = std::make_shared<std::promise<return_type>>();
-        auto future = promise->get_future();
+            if (free_cells == 0) {
+                size_t seq = cells[pos & mask].sequence.load(std::memory_order_acquire);
+                if (static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos) < 0) {
+                    break;
+                }
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+                continue;
+            }
 
-        auto task_func = [promise, func = std::bind(std::forward<F>(f), std::forward<Args>(args)...)]() mutable {
-            try {
-                if constexpr (std::is_void_v<return_type>) {
-                    func();
-                    promise->set_value();
-                } else {
-                    promise->set_value(func());
+            if (enqueue_pos.compare_exchange_weak(pos, pos + free_cells, std::memory_order_relaxed)) {
+                for (size_t i = 0; i < free_cells; ++i) {
+                    Cell& cell = cells[(pos + i) & mask];
+                    cell.data = items[pushed + i];
+                    cell.sequence.store(pos + i + 1, std::memory_order_release);
                 }
-            } catch (...) {
-                promise->set_exception(std::current_exception());
+                pushed += free_cells;
+                pos += free_cells;
             }
-        };
+        }
+        return pushed;
+    }
+
+    size_t pop_overflow(T** out, size_t max_items) {
+        std::lock_guard<std::mutex> lock(overflow_mutex);
+        size_t count = 0;
+        while (overflow_head && count < max_items) {
+            out[count++] = overflow_head;
+            overflow_head = overflow_head->next;
+        }
+        if (!overflow_head) {
+            overflow_tail = nullptr;
+        }
+        overflow_size.fetch_sub(count, std::memory_order_release);
+        return count;
+    }
+
+public:
+    explicit InjectionQueue(size_t capacity_pow2 = 8192)
+        : cells(new Cell[capacity_pow2]), capacity(capacity_pow2), mask(capacity_pow2 - 1) {
+        for (size_t i = 0; i < capacity; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+            cells[i].data = nullptr;
+        }
+    }
 
-        auto task = new Task{task_func};
+    InjectionQueue(const InjectionQueue&) = delete;
+    InjectionQueue& operator=(const InjectionQueue&) = delete;
 
-        size_t current_thread_id = get_thread_id();
-        bool enqueued_locally = false;
-        if (current_thread_id < worker_data.size()) {
-            enqueued_locally = worker_data[current_thread_id]->local_queue.push(task);
+    void push(T* item) {
+        if (overflow_size.load(std::memory_order_acquire) == 0 && try_push(item)) {
+            return;
         }
 
-        if (!enqueued_locally) {
-            Task* old_head = global_queue_head.load(std::memory_order_acquire);
-            do {
-                task->next = old_head;
-            } while (!global_queue_head.compare_exchange_weak(old_head, task,
-                                                              std::memory_order_release,
-                                                              std::memory_order_acquire));
-            global_queue_size.fetch_add(1, std::memory_order_relaxed);
+        item->next = nullptr;
+        std::lock_guard<std::mutex> lock(overflow_mutex);
+        if (overflow_tail) {
+            overflow_tail->next = item;
+        } else {
+            overflow_head = item;
         }
+        overflow_tail = item;
+        overflow_size.fetch_add(1, std::memory_order_release);
+    }
 
-        wake_sleeping_thread();
+    // Enqueues items in order; whatever does not fit in the ring is spliced
+    // onto the overflow list under one lock.
+    void push_bulk(T* const* items, size_t count) {
+        size_t pushed = 0;
+        if (overflow_size.load(std::memory_order_acquire) == 0) {
+            pushed = try_push_bulk(items, count);
+        }
+        if (pushed == count) {
+            return;
+        }
 
-        return future;
+        for (size_t i = pushed; i < count; ++i) {
+            items[i]->next = i + 1 < count ? items[i + 1] : nullptr;
+        }
+        std::lock_guard<std::mutex> lock(overflow_mutex);
+        if (overflow_tail) {
+            overflow_tail->next = items[pushed];
+        } else {
+            overflow_head = items[pushed];
+        }
+        overflow_tail = items[count - 1];
+        overflow_size.fetch_add(count - pushed, std::memory_order_release);
     }
 
-    void wait() {
-        while (active_tasks.load(std::memory_order_acquire) > 0 ||
-               global_queue_size.load(std::memory_order_acquire) > 0) {
-            std::this_thread::yield();
+    // Dequeues up to max_items of the oldest entries into out, returns how many.
+    size_t pop_bulk(T** out, size_t max_items) {
+        if (max_items == 0) {
+            return 0;
         }
 
-        bool all_empty = false;
-        while (!all_empty) {
-            all_empty = true;
-            for (const auto& data : worker_data) {
-                if (!data->local_queue.empty()) {
-                    all_empty = false;
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            size_t ready = 0;
+            while (ready < max_items) {
+                size_t seq = cells[(pos + ready) & mask].sequence.load(std::memory_order_acquire);
+                if (seq != pos + ready + 1) {
                     break;
                 }
+                ++ready;
             }
-            if (!all_empty) {
-                std::this_thread::yield();
+
+            if (ready == 0) {
+                size_t seq = cells[pos & mask].sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+                if (diff < 0) {
+                    break;
+                }
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            if (dequeue_pos.compare_exchange_weak(pos, pos + ready, std::memory_order_relaxed)) {
+                for (size_t i = 0; i < ready; ++i) {
+                    Cell& cell = cells[(pos + i) & mask];
+                    out[i] = cell.data;
+                    cell.sequence.store(pos + i + capacity, std::memory_order_release);
+                }
+                return ready;
             }
         }
+
+        if (overflow_size.load(std::memory_order_acquire) == 0) {
+            return 0;
+        }
+        return pop_overflow(out, max_items);
     }
 
-    size_t thread_count() const {
-        return threads.size();
+    T* pop() {
+        T* item = nullptr;
+        return pop_bulk(&item, 1) ? item : nullptr;
     }
 
-    size_t pending_tasks() const {
-        return global_queue_size.load(std::memory_order_acquire) +
-               active_tasks.load(std::memory_order_acquire);
+    size_t size() const {
+        size_t head = dequeue_pos.load(std::memory_order_acquire);
+        size_t tail = enqueue_pos.load(std::memory_order_acquire);
+        size_t ring = tail > head ? tail - head : 0;
+        return ring + overflow_size.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+};
+
+// Hierarchical timer wheel over integer ticks: LEVELS levels of 64
+// slots, level k covering 64^k ticks per slot. A node sits at the level of
+// the highest 6-bit group in which its due tick differs from the current
+// tick, and moves down a level each time that slot's range comes up.
+// Insert and remove are O(1) on intrusive lists; advance() skips empty
+// stretches using per-level occupancy bitmaps. Not thread-safe.
+class TimerWheel {
+public:
+    struct Node {
+        Node* prev{nullptr};
+        Node* next{nullptr};
+        uint64_t due{0};
+        uint8_t level{0};
+        uint8_t slot{0};
+    };
+
+    static constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+private:
+    static constexpr size_t SLOT_BITS = 6;
+    static constexpr size_t SLOTS = size_t{1} << SLOT_BITS;
+    static constexpr size_t LEVELS = 6;
+
+    uint64_t tick{0};
+    size_t count{0};
+    std::array<uint64_t, LEVELS> occupied{};
+    std::array<std::array<Node, SLOTS>, LEVELS> heads;
+
+    static uint64_t span(size_t level) {
+        return uint64_t{1} << (level * SLOT_BITS);
+    }
+
+    static size_t slot_of(uint64_t t, size_t level) {
+        return static_cast<size_t>(t >> (level * SLOT_BITS)) & (SLOTS - 1);
+    }
+
+    // Index of the highest / lowest set bit; bits must not be zero.
+    static size_t highest_bit(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<size_t>(63 - __builtin_clzll(bits));
+#elif defined(_MSC_VER) && defined(_M_X64)
+        unsigned long index;
+        _BitScanReverse64(&index, bits);
+        return index;
+#else
+        size_t index = 0;
+        while (bits >>= 1) {
+            ++index;
+        }
+        return index;
+#endif
+    }
+
+    static size_t lowest_bit(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<size_t>(__builtin_ctzll(bits));
+#elif defined(_MSC_VER) && defined(_M_X64)
+        unsigned long index;
+        _BitScanForward64(&index, bits);
+        return index;
+#else
+        size_t index = 0;
+        while (!(bits & 1)) {
+            bits >>= 1;
+            ++index;
+        }
+        return index;
+#endif
+    }
+
+    void place(Node* node) {
+        uint64_t diff = node->due ^ tick;
+        size_t level = diff == 0 ? 0 : highest_bit(diff) / SLOT_BITS;
+        level = std::min(level, LEVELS - 1);
+        size_t slot = slot_of(node->due, level);
+
+        Node& head = heads[level][slot];
+        node->level = static_cast<uint8_t>(level);
+        node->slot = static_cast<uint8_t>(slot);
+        node->prev = head.prev;
+        node->next = &head;
+        head.prev->next = node;
+        head.prev = node;
+        occupied[level] |= uint64_t{1} << slot;
+    }
+
+    // Unlinks a whole slot and returns its first node; the list is
+    // null-terminated through next.
+    Node* take(size_t level, size_t slot) {
+        Node& head = heads[level][slot];
+        if (head.next == &head) {
+            return nullptr;
+        }
+        Node* first = head.next;
+        head.prev->next = nullptr;
+        head.prev = head.next = &head;
+        occupied[level] &= ~(uint64_t{1} << slot);
+        return first;
+    }
+
+    // First tick after t at which something may happen: a level-0 slot
+    // fires or a higher slot cascades.
+    uint64_t next_after(uint64_t t) const {
+        size_t slot = slot_of(t, 0);
+        uint64_t later = occupied[0] & ~((uint64_t{2} << slot) - 1);
+        if (slot != SLOTS - 1 && later) {
+            return (t & ~uint64_t{SLOTS - 1}) + lowest_bit(later);
+        }
+        for (size_t level = 1; level < LEVELS; ++level) {
+            if (occupied[level]) {
+                return (t | (span(level) - 1)) + 1;
+            }
+        }
+        return NEVER;
+    }
+
+public:
+    explicit TimerWheel(uint64_t start = 0) : tick(start) {
+        for (auto& level : heads) {
+            for (auto& head : level) {
+                head.prev = head.next = &head;
+            }
+        }
     }
-};
\ No newline at end of file
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // Next tick advance() has not processed yet.
+    uint64_t current() const {
+        return tick;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    // Moves an empty wheel forward without walking the ticks in between.
+    void reset(uint64_t start) {
+        if (count == 0 && start > tick) {
+            tick = start;
+        }
+    }
+
+    // A due tick in the past is treated as current().
+    void insert(Node* node) {
+        node->due = std::max(node->due, tick);
+        place(node);
+        ++count;
+    }
+
+    void remove(Node* node) {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        Node& head = heads[node->level][node->slot];
+        if (head.next == &head) {
+            occupied[node->level] &= ~(uint64_t{1} << node->slot);
+        }
+        node->prev = node->next = nullptr;
+        --count;
+    }
+
+    // Lower bound on the earliest due tick, NEVER when empty.
+    uint64_t next_event() const {
+        if (count == 0) {
+            return NEVER;
+        }
+        for (size_t level = LEVELS; level-- > 0;) {
+            if ((tick & (span(level) - 1)) == 0 && (occupied[level] >> slot_of(tick, level)) & 1) {
+                return tick;
+            }
+        }
+        return next_after(tick);
+    }
+
+    // Calls fire(node) for every node due at or before now, after unlinking
+    // it. fire must not touch the wheel.
+    template<typename Fire>
+    void advance(uint64_t now, Fire&& fire) {
+        while (count > 0 && tick <= now) {
+            for (size_t level = LEVELS - 1; level > 0; --level) {
+                if ((tick & (span(level) - 1)) == 0) {
+                    for (Node* node = take(level, slot_of(tick, level)); node;) {
+                        Node* next = node->next;
+                        place(node);
+                        node = next;
+                    }
+                }
+            }
+            for (Node* node = take(0, slot_of(tick, 0)); node;) {
+                Node* next = node->next;
+                --count;
+                node->prev = node->next = nullptr;
+                fire(node);
+                node = next;
+            }
+            tick = std::min(next_after(tick), now + 1);
+        }
+        tick = std::max(tick, now + 1);
+    }
+
+    // Unlinks every node and passes it to fire, regardless of due tick.
+    template<typename Fire>
+    void clear(Fire&& fire) {
+        for (size_t level = 0; level < LEVELS; ++level) {
+            for (size_t slot = 0; slot < SLOTS; ++slot) {
+                for (Node* node = take(level, slot); node;) {
+                    Node* next = node->next;
+                    --count;
+                    node->prev = node->next = nullptr;
+                    fire(node);
+                    node = next;
+                }
+            }
+        }
+    }
+};
+
+// Move-only type-erased `void()` callable. Closures up to Capacity bytes are
+// stored inline (the default makes the whole object one cache line), larger
+// ones spill to the heap. Unlike std::function it accepts move-only captures.
+template<size_t Capacity = 64 - sizeof(void*)>
+class TaskFunction {
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*relocate)(void* dst, void* src) noexcept;
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template<typename F>
+    static constexpr bool fits_inline = sizeof(F) <= Capacity &&
+                                        alignof(F) <= alignof(std::max_align_t) &&
+                                        std::is_nothrow_move_constructible_v<F>;
+
+    template<typename F>
+    static const Ops* inline_ops() {
+        static constexpr Ops ops{
+            [](void* storage) { (*static_cast<F*>(storage))(); },
+            [](void* dst, void* src) noexcept {
+                new (dst) F(std::move(*static_cast<F*>(src)));
+                static_cast<F*>(src)->~F();
+            },
+            [](void* storage) noexcept { static_cast<F*>(storage)->~F(); }
+        };
+        return &ops;
+    }
+
+    template<typename F>
+    static const Ops* heap_ops() {
+        static constexpr Ops ops{
+            [](void* storage) { (**static_cast<F**>(storage))(); },
+            [](void* dst, void* src) noexcept { *static_cast<F**>(dst) = *static_cast<F**>(src); },
+            [](void* storage) noexcept { delete *static_cast<F**>(storage); }
+        };
+        return &ops;
+    }
+
+    alignas(std::max_align_t) unsigned char storage[Capacity];
+    const Ops* ops{nullptr};
+
+public:
+    TaskFunction() noexcept = default;
+
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, TaskFunction>>>
+    TaskFunction(F&& f) {
+        using Fn = std::decay_t<F>;
+        if constexpr (fits_inline<Fn>) {
+            new (storage) Fn(std::forward<F>(f));
+            ops = inline_ops<Fn>();
+        } else {
+            *reinterpret_cast<Fn**>(storage) = new Fn(std::forward<F>(f));
+            ops = heap_ops<Fn>();
+        }
+    }
+
+    TaskFunction(TaskFunction&& other) noexcept : ops(other.ops) {
+        if (ops) {
+            ops->relocate(storage, other.storage);
+            other.ops = nullptr;
+        }
+    }
+
+    TaskFunction& operator=(TaskFunction&& other) noexcept {
+        if (this != &other) {
+            reset();
+            if (other.ops) {
+                other.ops->relocate(storage, other.storage);
+                ops = other.ops;
+                other.ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    TaskFunction(const TaskFunction&) = delete;
+    TaskFunction& operator=(const TaskFunction&) = delete;
+
+    ~TaskFunction() {
+        reset();
+    }
+
+    void reset() noexcept {
+        if (ops) {
+            const Ops* old = ops;
+            ops = nullptr;
+            old->destroy(storage);
+        }
+    }
+
+    void operator()() {
+        ops->invoke(storage);
+    }
+
+    explicit operator bool() const noexcept {
+        return ops != nullptr;
+    }
+
+    template<typename F>
+    static constexpr bool stores_inline() {
+        return fits_inline<std::decay_t<F>>;
+    }
+};
+
+// Fixed-size block allocator with one instance per owner thread. The owner
+// allocates and frees through a plain free list; any other thread returns a
+// block through an intrusive lock-free stack that the owner takes over
+// wholesale when its own list runs dry, so there is no ABA to worry about.
+// Requests larger than a block fall back to the heap transparently.
+//
+// Slabs are heap-allocated and given up with retire() rather than deleted:
+// blocks can outlive their owner (a future kept after its pool is gone), so
+// a retired slab frees itself once the last outstanding block comes back.
+class TaskSlab {
+private:
+    struct BlockHeader {
+        TaskSlab* home;
+        BlockHeader* next;
+    };
+
+    static constexpr size_t HEADER_SIZE = alignof(std::max_align_t) > sizeof(BlockHeader)
+                                              ? alignof(std::max_align_t)
+                                              : sizeof(BlockHeader);
+
+    BlockHeader* local_free{nullptr};
+    std::vector<void*> chunks;
+    std::atomic<size_t> reserved{0};
+
+    alignas(64) std::atomic<BlockHeader*> remote_free{nullptr};
+    std::atomic<uint32_t> remote_in_flight{0};
+    std::atomic<bool> retired{false};
+    // After retirement: outstanding blocks minus blocks returned since.
+    std::atomic<std::ptrdiff_t> retired_balance{0};
+
+    ~TaskSlab() {
+        for (void* chunk : chunks) {
+            ::operator delete(chunk, std::align_val_t{64});
+        }
+    }
+
+    static BlockHeader* header_of(void* payload) {
+        return reinterpret_cast<BlockHeader*>(static_cast<unsigned char*>(payload) - HEADER_SIZE);
+    }
+
+    static void* payload_of(BlockHeader* header) {
+        return reinterpret_cast<unsigned char*>(header) + HEADER_SIZE;
+    }
+
+    void refill() {
+        local_free = remote_free.exchange(nullptr, std::memory_order_acquire);
+        if (local_free) {
+            return;
+        }
+
+        void* chunk = ::operator new(BLOCK_SIZE * BLOCKS_PER_CHUNK, std::align_val_t{64});
+        chunks.push_back(chunk);
+        auto* bytes = static_cast<unsigned char*>(chunk);
+        for (size_t i = BLOCKS_PER_CHUNK; i-- > 0;) {
+            auto* header = reinterpret_cast<BlockHeader*>(bytes + i * BLOCK_SIZE);
+            header->home = this;
+            header->next = local_free;
+            local_free = header;
+        }
+        reserved.fetch_add(BLOCKS_PER_CHUNK, std::memory_order_relaxed);
+    }
+
+    void settle_retired(std::ptrdiff_t delta) {
+        if (retired_balance.fetch_add(delta, std::memory_order_acq_rel) + delta == 0) {
+            delete this;
+        }
+    }
+
+    void free_remote(BlockHeader* header) {
+        remote_in_flight.fetch_add(1, std::memory_order_seq_cst);
+        if (retired.load(std::memory_order_seq_cst)) {
+            remote_in_flight.fetch_sub(1, std::memory_order_relaxed);
+            settle_retired(-1);
+            return;
+        }
+
+        BlockHeader* head = remote_free.load(std::memory_order_relaxed);
+        do {
+            header->next = head;
+        } while (!remote_free.compare_exchange_weak(head, header,
+                                                    std::memory_order_release,
+                                                    std::memory_order_relaxed));
+        remote_in_flight.fetch_sub(1, std::memory_order_release);
+    }
+
+public:
+    static constexpr size_t BLOCK_SIZE = 256;
+    static constexpr size_t BLOCKS_PER_CHUNK = 64;
+    static constexpr size_t PAYLOAD_SIZE = BLOCK_SIZE - HEADER_SIZE;
+
+    TaskSlab() = default;
+    TaskSlab(const TaskSlab&) = delete;
+    TaskSlab& operator=(const TaskSlab&) = delete;
+
+    // The slab owned by the calling thread, if any. Frees of its own blocks
+    // skip the atomic remote path.
+    static TaskSlab*& thread_slab() {
+        static thread_local TaskSlab* slab = nullptr;
+        return slab;
+    }
+
+    // Called once by the owner after it stopped allocating.
+    static void retire(TaskSlab* slab) {
+        slab->retired.store(true, std::memory_order_seq_cst);
+        while (slab->remote_in_flight.load(std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+
+        size_t returned = 0;
+        for (BlockHeader* h = slab->local_free; h; h = h->next) {
+            ++returned;
+        }
+        for (BlockHeader* h = slab->remote_free.exchange(nullptr, std::memory_order_acquire); h; h = h->next) {
+            ++returned;
+        }
+        slab->settle_retired(static_cast<std::ptrdiff_t>(slab->reserved_blocks() - returned));
+    }
+
+    // A heap block that deallocate() accepts like any other; for callers
+    // without a slab at hand.
+    static void* allocate_unowned(size_t bytes) {
+        auto* header = static_cast<BlockHeader*>(::operator new(HEADER_SIZE + bytes));
+        header->home = nullptr;
+        return payload_of(header);
+    }
+
+    // Owner only (or whoever serialises access to this slab).
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+        if (bytes > PAYLOAD_SIZE || alignment > alignof(std::max_align_t)) {
+            return allocate_unowned(bytes);
+        }
+
+        if (!local_free) {
+            refill();
+        }
+        BlockHeader* header = local_free;
+        local_free = header->next;
+        return payload_of(header);
+    }
+
+    // Any thread.
+    static void deallocate(void* payload) {
+        BlockHeader* header = header_of(payload);
+        TaskSlab* home = header->home;
+
+        if (!home) {
+            ::operator delete(header);
+        } else if (home == thread_slab()) {
+            header->next = home->local_free;
+            home->local_free = header;
+        } else {
+            home->free_remote(header);
+        }
+    }
+
+    // Number of blocks this slab has carved out of the heap so far.
+    size_t reserved_blocks() const {
+        return reserved.load(std::memory_order_relaxed);
+    }
+};
+
+class LockFreeThreadPool;
+
+// Shared state behind a TaskFuture: a status word the waiter can futex on,
+// an intrusive reference count and the exception slot. The owner supplies
+// the destroy function, which lets the state live inside a task allocation.
+// A state also has one continuation slot, fired once when it becomes ready,
+// and remembers the pool that produced it for then().
+class FutureStateBase {
+public:
+    struct Continuation {
+        void (*fire)(Continuation* self, FutureStateBase* source){nullptr};
+    };
+
+private:
+    static constexpr uint32_t READY = 1;
+    static constexpr uint32_t WAITING = 2;
+    static constexpr uint32_t HELPER = 4;
+
+    std::atomic<uint32_t> status{0};
+    std::atomic<uint32_t> refs;
+    HelperSlot helper;
+    void (*destroy)(FutureStateBase*);
+    std::atomic<Continuation*> continuation{nullptr};
+    LockFreeThreadPool* executor{nullptr};
+
+    // Stored in the continuation slot once the state has fired it.
+    static Continuation* fired_marker() {
+        static Continuation marker;
+        return &marker;
+    }
+
+protected:
+    std::exception_ptr error;
+
+    FutureStateBase(uint32_t initial_refs, void (*destroy_fn)(FutureStateBase*))
+        : refs(initial_refs), destroy(destroy_fn) {}
+
+    ~FutureStateBase() = default;
+
+    // Callers hold a reference, so the state outlives the continuation call.
+    void mark_ready() {
+        SharedEventCount* wake;
+        if (helper.update(status, HELPER, [](uint32_t) { return READY; }, wake) & WAITING) {
+            Futex::wake(status, std::numeric_limits<int>::max());
+        }
+        HelperSlot::notify(wake);
+        Continuation* next = continuation.exchange(fired_marker(), std::memory_order_acq_rel);
+        if (next) {
+            next->fire(next, this);
+        }
+    }
+
+public:
+    // Pool workers install one of these: a worker that waits on a future
+    // runs other tasks until it is ready instead of blocking its thread.
+    struct WaitHelper {
+        void (*help)(void* context, FutureStateBase& state){nullptr};
+        void* context{nullptr};
+    };
+
+    static WaitHelper& thread_wait_helper() {
+        static thread_local WaitHelper helper;
+        return helper;
+    }
+
+    FutureStateBase(const FutureStateBase&) = delete;
+    FutureStateBase& operator=(const FutureStateBase&) = delete;
+
+    bool is_ready() const {
+        return status.load(std::memory_order_acquire) & READY;
+    }
+
+    // For a pool worker about to park on sleepers while it waits here.
+    bool add_helper(SharedEventCount& sleepers) {
+        return helper.arm(status, HELPER, sleepers);
+    }
+
+    void wait() {
+        if (is_ready()) {
+            return;
+        }
+        const WaitHelper& helper = thread_wait_helper();
+        if (helper.help) {
+            helper.help(helper.context, *this);
+            return;
+        }
+
+        uint32_t current = status.load(std::memory_order_acquire);
+        while (!(current & READY)) {
+            if (!(current & WAITING) &&
+                !status.compare_exchange_weak(current, current | WAITING, std::memory_order_acquire)) {
+                continue;
+            }
+            Futex::wait(status, current | WAITING);
+            current = status.load(std::memory_order_acquire);
+        }
+    }
+
+    void set_exception(std::exception_ptr e) {
+        error = std::move(e);
+        mark_ready();
+    }
+
+    // Fires c once this state is ready: right away if it already is,
+    // otherwise from whichever thread completes it. One per state.
+    void add_continuation(Continuation* c) {
+        Continuation* expected = nullptr;
+        if (!continuation.compare_exchange_strong(expected, c, std::memory_order_acq_rel)) {
+            c->fire(c, this);
+        }
+    }
+
+    // Empties the slot again if c is still waiting in it. Returns false if c
+    // has fired or is about to.
+    bool remove_continuation(Continuation* c) {
+        Continuation* expected = c;
+        return continuation.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+    }
+
+    LockFreeThreadPool* executor_pool() const {
+        return executor;
+    }
+
+    void set_executor_pool(LockFreeThreadPool* pool) {
+        executor = pool;
+    }
+
+    void add_ref() {
+        refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            destroy(this);
+        }
+    }
+};
+
+template<typename R>
+class FutureState : public FutureStateBase {
+private:
+    using Stored = std::conditional_t<std::is_reference_v<R>, std::remove_reference_t<R>*, R>;
+
+    alignas(Stored) unsigned char storage[sizeof(Stored)];
+    bool has_value{false};
+
+    Stored* value_ptr() {
+        return std::launder(reinterpret_cast<Stored*>(storage));
+    }
+
+protected:
+    using FutureStateBase::FutureStateBase;
+
+    ~FutureState() {
+        if (has_value) {
+            value_ptr()->~Stored();
+        }
+    }
+
+public:
+    template<typename U>
+    void set_value(U&& value) {
+        if constexpr (std::is_reference_v<R>) {
+            new (storage) Stored(&value);
+        } else {
+            new (storage) Stored(std::forward<U>(value));
+        }
+        has_value = true;
+        mark_ready();
+    }
+
+    // Ready states only. Rethrows the stored exception or moves the value out.
+    R take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        if constexpr (std::is_reference_v<R>) {
+            return **value_ptr();
+        } else {
+            return std::move(*value_ptr());
+        }
+    }
+};
+
+template<>
+class FutureState<void> : public FutureStateBase {
+protected:
+    using FutureStateBase::FutureStateBase;
+    ~FutureState() = default;
+
+public:
+    void set_value() {
+        mark_ready();
+    }
+
+    void take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+template<typename R>
+class WhenAllState;
+template<typename R>
+class WhenAnyState;
+
+// Pool-native future. Move-only; get() consumes it like std::future::get().
+template<typename R>
+class TaskFuture {
+private:
+    template<typename> friend class WhenAllState;
+    template<typename> friend class WhenAnyState;
+
+    FutureState<R>* state{nullptr};
+
+    void reset() noexcept {
+        if (state) {
+            std::exchange(state, nullptr)->release();
+        }
+    }
+
+public:
+    TaskFuture() noexcept = default;
+    explicit TaskFuture(FutureState<R>* s) noexcept : state(s) {}
+
+    TaskFuture(TaskFuture&& other) noexcept : state(std::exchange(other.state, nullptr)) {}
+
+    TaskFuture& operator=(TaskFuture&& other) noexcept {
+        if (this != &other) {
+            reset();
+            state = std::exchange(other.state, nullptr);
+        }
+        return *this;
+    }
+
+    TaskFuture(const TaskFuture&) = delete;
+    TaskFuture& operator=(const TaskFuture&) = delete;
+
+    ~TaskFuture() {
+        reset();
+    }
+
+    bool valid() const noexcept {
+        return state != nullptr;
+    }
+
+    bool is_ready() const {
+        return state->is_ready();
+    }
+
+    void wait() const {
+        state->wait();
+    }
+
+    R get() {
+        state->wait();
+        struct Release {
+            TaskFuture* self;
+            ~Release() { self->reset(); }
+        } release{this};
+        return state->take();
+    }
+
+    // Consumes the future and returns one for f(value) (or f() for void),
+    // scheduled on the producing pool when this one completes; nothing
+    // blocks in between. If this future failed, f is skipped and the error
+    // is passed on.
+    template<typename F>
+    auto then(F&& f);
+};
+
+template<typename F, typename R>
+using then_result_t = typename std::conditional_t<std::is_void_v<R>,
+                                                  std::invoke_result<F>,
+                                                  std::invoke_result<F, R>>::type;
+
+// Ready once every input is; yields the (ready) input futures in order.
+template<typename R>
+class WhenAllState final : public FutureState<std::vector<TaskFuture<R>>>,
+                           public FutureStateBase::Continuation {
+private:
+    using Base = FutureState<std::vector<TaskFuture<R>>>;
+
+    std::vector<TaskFuture<R>> inputs;
+    // One per input plus one held by arm(), so the inputs are not moved out
+    // while they are still being registered.
+    std::atomic<size_t> remaining;
+
+    static void fire_one(Continuation* c, FutureStateBase*) {
+        auto* self = static_cast<WhenAllState*>(c);
+        if (self->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            self->set_value(std::move(self->inputs));
+            self->release();
+        }
+    }
+
+    static void destroy_state(FutureStateBase* state) {
+        delete static_cast<WhenAllState*>(static_cast<Base*>(state));
+    }
+
+public:
+    explicit WhenAllState(std::vector<TaskFuture<R>> futures)
+        : Base(2, &destroy_state), inputs(std::move(futures)), remaining(inputs.size() + 1) {
+        this->fire = &fire_one;
+        if (!inputs.empty()) {
+            this->set_executor_pool(inputs.front().state->executor_pool());
+        }
+    }
+
+    void arm() {
+        for (auto& input : inputs) {
+            input.state->add_continuation(this);
+        }
+        fire_one(this, nullptr);
+    }
+};
+
+template<typename R>
+struct WhenAnyResult {
+    // Position of the first input to complete, futures.size() if there were none.
+    size_t index;
+    std::vector<TaskFuture<R>> futures;
+};
+
+// Ready once the first input is. Every registration holds a reference, as
+// inputs that finish later still fire into this state.
+template<typename R>
+class WhenAnyState final : public FutureState<WhenAnyResult<R>>,
+                           public FutureStateBase::Continuation {
+private:
+    using Base = FutureState<WhenAnyResult<R>>;
+
+    std::vector<TaskFuture<R>> inputs;
+    std::atomic<FutureStateBase*> winner{nullptr};
+    // Opened by the first completion and by arm() finishing its registrations.
+    std::atomic<int> gate{2};
+
+    void open_gate() {
+        if (gate.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        FutureStateBase* first = winner.load(std::memory_order_acquire);
+        // Free the losers' slots so they can be chained on again; a loser
+        // that fired already releases its registration in fire_one.
+        for (auto& input : inputs) {
+            if (input.state != first && input.state->remove_continuation(this)) {
+                this->release();
+            }
+        }
+        size_t index = 0;
+        while (index < inputs.size() && static_cast<FutureStateBase*>(inputs[index].state) != first) {
+            ++index;
+        }
+        this->set_value(WhenAnyResult<R>{index, std::move(inputs)});
+    }
+
+    static void fire_one(Continuation* c, FutureStateBase* source) {
+        auto* self = static_cast<WhenAnyState*>(c);
+        FutureStateBase* expected = nullptr;
+        if (self->winner.compare_exchange_strong(expected, source, std::memory_order_acq_rel)) {
+            self->open_gate();
+        }
+        self->release();
+    }
+
+    static void destroy_state(FutureStateBase* state) {
+        delete static_cast<WhenAnyState*>(static_cast<Base*>(state));
+    }
+
+public:
+    explicit WhenAnyState(std::vector<TaskFuture<R>> futures)
+        : Base(static_cast<uint32_t>(futures.size()) + 2, &destroy_state), inputs(std::move(futures)) {
+        this->fire = &fire_one;
+        if (!inputs.empty()) {
+            this->set_executor_pool(inputs.front().state->executor_pool());
+        }
+    }
+
+    void arm() {
+        for (auto& input : inputs) {
+            input.state->add_continuation(this);
+        }
+        if (inputs.empty()) {
+            open_gate();
+        }
+        open_gate();
+        this->release();
+    }
+};
+
+// Joins the futures without parking a thread: the last one to complete
+// makes the result ready.
+template<typename R>
+TaskFuture<std::vector<TaskFuture<R>>> when_all(std::vector<TaskFuture<R>> futures) {
+    auto* state = new WhenAllState<R>(std::move(futures));
+    state->arm();
+    return TaskFuture<std::vector<TaskFuture<R>>>(state);
+}
+
+// Becomes ready with the index of the first future to complete.
+template<typename R>
+TaskFuture<WhenAnyResult<R>> when_any(std::vector<TaskFuture<R>> futures) {
+    auto* state = new WhenAnyState<R>(std::move(futures));
+    state->arm();
+    return TaskFuture<WhenAnyResult<R>>(state);
+}
+
+// Where workers run. Compact fills one node (and one core's SMT siblings)
+// before the next; Scatter round-robins over nodes and puts one worker per
+// physical core before using siblings; PhysicalCores uses only the first
+// hardware thread of every core; Explicit takes ThreadPoolOptions::cpus.
+// Every policy but None pins each worker to its CPU; with more workers than
+// CPUs the list wraps around.
+enum class ThreadPlacement {
+    None,
+    Compact,
+    Scatter,
+    PhysicalCores,
+    Explicit,
+};
+
+// CPUs grouped by NUMA node, as listed by Linux sysfs: <root>/online names
+// the nodes and <root>/node<N>/cpulist their CPUs. Nodes without CPUs are
+// left out, so index i is the i-th node that has any. If nothing can be
+// read the whole machine is one node. cores groups SMT siblings, from
+// cpu<N>/topology/thread_siblings_list; without it every CPU is a core.
+struct CpuTopology {
+    std::vector<std::vector<unsigned>> nodes;
+    std::vector<std::vector<unsigned>> cores;
+
+    // Parses the kernel's list format, e.g. "0-3,8,10-11". Returns an empty
+    // list for malformed input.
+    static std::vector<unsigned> parse_cpu_list(const std::string& text) {
+        std::vector<unsigned> cpus;
+        size_t pos = 0;
+        while (pos < text.size() && text[pos] != '\n') {
+            size_t used = 0;
+            unsigned long first;
+            unsigned long last;
+            try {
+                first = std::stoul(text.substr(pos), &used);
+                pos += used;
+                last = first;
+                if (pos < text.size() && text[pos] == '-') {
+                    last = std::stoul(text.substr(pos + 1), &used);
+                    pos += used + 1;
+                }
+            } catch (const std::exception&) {
+                return {};
+            }
+            if (last < first || last - first > 65536) {
+                return {};
+            }
+            for (unsigned long cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(static_cast<unsigned>(cpu));
+            }
+            if (pos < text.size() && text[pos] == ',') {
+                ++pos;
+            }
+        }
+        return cpus;
+    }
+
+    static CpuTopology single_node(unsigned cpus) {
+        CpuTopology topology;
+        topology.nodes.emplace_back();
+        for (unsigned cpu = 0; cpu < std::max(1u, cpus); ++cpu) {
+            topology.nodes[0].push_back(cpu);
+        }
+        return topology;
+    }
+
+    static CpuTopology from_sysfs(const std::string& root = "/sys/devices/system/node",
+                                  const std::string& cpu_root = "/sys/devices/system/cpu") {
+        auto read = [](const std::string& path) {
+            std::ifstream file(path);
+            std::string line;
+            std::getline(file, line);
+            return line;
+        };
+
+        CpuTopology topology;
+        for (unsigned node : parse_cpu_list(read(root + "/online"))) {
+            auto cpus = parse_cpu_list(read(root + "/node" + std::to_string(node) + "/cpulist"));
+            if (!cpus.empty()) {
+                topology.nodes.push_back(std::move(cpus));
+            }
+        }
+        if (topology.nodes.empty()) {
+            topology = single_node(std::thread::hardware_concurrency());
+        }
+
+        for (const auto& node : topology.nodes) {
+            for (unsigned cpu : node) {
+                auto siblings = parse_cpu_list(
+                    read(cpu_root + "/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list"));
+                if (!siblings.empty() && siblings[0] == cpu) {
+                    topology.cores.push_back(std::move(siblings));
+                }
+            }
+        }
+        return topology;
+    }
+
+    // CPUs in the calling thread's sched_getaffinity mask, ascending; empty if
+    // it cannot be read.
+    static std::vector<unsigned> allowed_cpus() {
+        std::vector<unsigned> cpus;
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &set)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+#endif
+        return cpus;
+    }
+
+    // The part of this topology within allowed, e.g. allowed_cpus() under
+    // taskset or a cpuset. Nodes and cores left without CPUs are dropped; if
+    // no node keeps any, allowed becomes a single node. An empty allowed
+    // list keeps everything.
+    CpuTopology restricted_to(const std::vector<unsigned>& allowed) const {
+        if (allowed.empty()) {
+            return *this;
+        }
+        auto keep = [&allowed](const std::vector<std::vector<unsigned>>& groups) {
+            std::vector<std::vector<unsigned>> kept;
+            for (const auto& group : groups) {
+                std::vector<unsigned> cpus;
+                std::copy_if(group.begin(), group.end(), std::back_inserter(cpus), [&allowed](unsigned cpu) {
+                    return std::find(allowed.begin(), allowed.end(), cpu) != allowed.end();
+                });
+                if (!cpus.empty()) {
+                    kept.push_back(std::move(cpus));
+                }
+            }
+            return kept;
+        };
+
+        CpuTopology topology;
+        topology.nodes = keep(nodes);
+        topology.cores = keep(cores);
+        if (topology.nodes.empty()) {
+            topology.nodes.push_back(allowed);
+        }
+        return topology;
+    }
+
+    // One CPU per worker under the given policy (not Explicit). For None the
+    // workers are spread over all CPUs in proportion, without pinning.
+    std::vector<unsigned> place(ThreadPlacement policy, size_t workers) const {
+        // Per node, its cores as lists of SMT siblings on that node.
+        std::vector<std::vector<std::vector<unsigned>>> node_cores(nodes.size());
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            auto on_node = [&](unsigned cpu) {
+                return std::find(nodes[n].begin(), nodes[n].end(), cpu) != nodes[n].end();
+            };
+            for (unsigned cpu : nodes[n]) {
+                auto core = std::find_if(cores.begin(), cores.end(), [cpu](const std::vector<unsigned>& c) {
+                    return std::find(c.begin(), c.end(), cpu) != c.end();
+                });
+                if (core == cores.end() || !on_node(core->front())) {
+                    node_cores[n].push_back({cpu});
+                } else if (core->front() == cpu) {
+                    node_cores[n].emplace_back();
+                    std::copy_if(core->begin(), core->end(), std::back_inserter(node_cores[n].back()), on_node);
+                }
+            }
+        }
+
+        std::vector<unsigned> order;
+        if (policy == ThreadPlacement::Scatter) {
+            // Per node: the first thread of every core, then the second...;
+            // then the nodes interleaved.
+            std::vector<std::vector<unsigned>> by_node(nodes.size());
+            size_t longest = 0;
+            for (size_t n = 0; n < nodes.size(); ++n) {
+                size_t widest = 0;
+                for (const auto& core : node_cores[n]) {
+                    widest = std::max(widest, core.size());
+                }
+                for (size_t rank = 0; rank < widest; ++rank) {
+                    for (const auto& core : node_cores[n]) {
+                        if (rank < core.size()) {
+                            by_node[n].push_back(core[rank]);
+                        }
+                    }
+                }
+                longest = std::max(longest, by_node[n].size());
+            }
+            for (size_t i = 0; i < longest; ++i) {
+                for (const auto& list : by_node) {
+                    if (i < list.size()) {
+                        order.push_back(list[i]);
+                    }
+                }
+            }
+        } else {
+            for (const auto& node : node_cores) {
+                for (const auto& core : node) {
+                    if (policy == ThreadPlacement::PhysicalCores) {
+                        order.push_back(core.front());
+                    } else {
+                        order.insert(order.end(), core.begin(), core.end());
+                    }
+                }
+            }
+        }
+
+        std::vector<unsigned> cpus(workers);
+        for (size_t i = 0; i < workers && !order.empty(); ++i) {
+            cpus[i] = policy == ThreadPlacement::None ? order[i * order.size() / workers] : order[i % order.size()];
+        }
+        return cpus;
+    }
+
+    size_t cpu_count() const {
+        size_t count = 0;
+        for (const auto& node : nodes) {
+            count += node.size();
+        }
+        return count;
+    }
+};
+
+// How many CPUs this process may really use: the sched_getaffinity mask,
+// capped by the cgroup CPU quota (v2 cpu.max, v1 cpu.cfs_quota_us over
+// cpu.cfs_period_us) of the process's cgroup and its ancestors. A fractional
+// quota is rounded down, to at least one CPU, so a full pool is not throttled.
+struct CpuQuota {
+    // The tightest quota in CPUs, or 0 if there is none or nothing can be
+    // read. self is the /proc/<pid>/cgroup listing the process's cgroups.
+    static double cgroup_limit(const std::string& root = "/sys/fs/cgroup",
+                               const std::string& self = "/proc/self/cgroup") {
+        auto read = [](const std::string& path) {
+            std::ifstream file(path);
+            std::string line;
+            std::getline(file, line);
+            return line;
+        };
+        auto ratio = [](const std::string& quota, const std::string& period) {
+            try {
+                double q = std::stod(quota);
+                double p = std::stod(period);
+                return q > 0 && p > 0 ? q / p : 0.0;
+            } catch (const std::exception&) {
+                return 0.0;
+            }
+        };
+        auto limit_at = [&](const std::string& dir, bool v2) {
+            if (v2) {
+                std::string line = read(dir + "/cpu.max");
+                size_t space = line.find(' ');
+                return space == std::string::npos ? 0.0 : ratio(line.substr(0, space), line.substr(space + 1));
+            }
+            return ratio(read(dir + "/cpu.cfs_quota_us"), read(dir + "/cpu.cfs_period_us"));
+        };
+
+        // Lines are "<id>:<controllers>:<path>"; v2 has no controllers. The
+        // path may not exist inside a container, whose own cgroup is then
+        // mounted at the root, so walk up to it.
+        double limit = 0;
+        auto consider = [&](const std::string& base, std::string path, bool v2) {
+            while (true) {
+                double found = limit_at(base + path, v2);
+                if (found > 0 && (limit == 0 || found < limit)) {
+                    limit = found;
+                }
+                size_t slash = path.find_last_of('/');
+                if (path.empty() || path == "/" || slash == std::string::npos) {
+                    break;
+                }
+                path.erase(slash);
+            }
+        };
+
+        std::ifstream cgroups(self);
+        std::string line;
+        bool listed = false;
+        while (std::getline(cgroups, line)) {
+            size_t first = line.find(':');
+            size_t second = first == std::string::npos ? first : line.find(':', first + 1);
+            if (second == std::string::npos) {
+                continue;
+            }
+            std::string controllers = line.substr(first + 1, second - first - 1);
+            std::string path = line.substr(second + 1);
+            if (controllers.empty()) {
+                consider(root, path, true);
+                listed = true;
+            } else if (("," + controllers + ",").find(",cpu,") != std::string::npos) {
+                consider(root + "/" + controllers, path, false);
+                consider(root + "/cpu", path, false);
+                listed = true;
+            }
+        }
+        if (!listed) {
+            consider(root, "", true);
+            consider(root + "/cpu", "", false);
+        }
+        return limit;
+    }
+
+    static size_t affinity_cpus() {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+            return static_cast<size_t>(CPU_COUNT(&set));
+        }
+#endif
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    static size_t available(const std::string& root = "/sys/fs/cgroup",
+                            const std::string& self = "/proc/self/cgroup") {
+        size_t cpus = affinity_cpus();
+        double limit = cgroup_limit(root, self);
+        if (limit > 0) {
+            cpus = std::min(cpus, std::max<size_t>(1, static_cast<size_t>(limit)));
+        }
+        return cpus;
+    }
+
+    // available() for this process, read once. The pool's default size.
+    static size_t detected() {
+        static const size_t cpus = available();
+        return cpus;
+    }
+};
+
+// What a worker does with a task when its deque is full. Grow doubles the
+// deque; RunInline runs the task right away on the spawning thread, so deep
+// recursion turns into depth-first execution; Spill hands it to the shared
+// global queue.
+enum class QueueOverflow {
+    Grow,
+    RunInline,
+    Spill,
+};
+
+struct ThreadPoolOptions {
+    size_t num_threads = CpuQuota::detected();
+    // Left empty, it is read from sysfs and limited to the CPUs in the
+    // affinity mask of the constructing thread.
+    CpuTopology topology;
+    ThreadPlacement placement = ThreadPlacement::None;
+    // CPU of each worker for ThreadPlacement::Explicit, wrapping around.
+    std::vector<unsigned> cpus;
+    // Initial tasks each worker deque holds per priority level; rounded up to
+    // a power of two. Small by default, since the deques grow on demand.
+    size_t local_queue_capacity = 512;
+    QueueOverflow local_queue_overflow = QueueOverflow::Grow;
+};
+
+// Scheduling levels, most urgent first. Workers drain a higher level before
+// a lower one; see LockFreeThreadPool::AGING_PERIOD for starvation.
+enum class TaskPriority : uint8_t {
+    High = 0,
+    Normal = 1,
+    Low = 2,
+};
+
+// Set on the future of a deadline task that had not started by its deadline.
+class DeadlineExpiredError : public std::runtime_error {
+public:
+    DeadlineExpiredError() : std::runtime_error("task deadline expired before it started") {}
+};
+
+// Set on the future of a task whose cancellation token fired before it
+// started.
+class TaskCancelledError : public std::runtime_error {
+public:
+    TaskCancelledError() : std::runtime_error("task cancelled before it started") {}
+};
+
+class TaskGroup;
+
+// Read side of a CancellationSource; cheap to copy. A token also reports
+// cancellation once any ancestor source is cancelled, so cancelling a parent
+// cascades to everything derived from it without registering anything. A
+// default-constructed token is never cancelled.
+class CancellationToken {
+private:
+    friend class CancellationSource;
+    friend class LockFreeThreadPool;
+    friend class TaskGroup;
+
+    struct State {
+        std::atomic<bool> cancelled{false};
+        std::shared_ptr<State> parent;
+    };
+
+    std::shared_ptr<State> state;
+
+    explicit CancellationToken(std::shared_ptr<State> s) : state(std::move(s)) {}
+
+    static const CancellationToken*& current_slot() {
+        static thread_local const CancellationToken* current = nullptr;
+        return current;
+    }
+
+    // Makes token current() while a task body runs.
+    struct Scope {
+        const CancellationToken* saved;
+
+        explicit Scope(const CancellationToken& token) : saved(std::exchange(current_slot(), &token)) {}
+        ~Scope() { current_slot() = saved; }
+    };
+
+public:
+    CancellationToken() = default;
+
+    bool is_cancelled() const {
+        for (const State* s = state.get(); s; s = s->parent.get()) {
+            if (s->cancelled.load(std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void throw_if_cancelled() const {
+        if (is_cancelled()) {
+            throw TaskCancelledError();
+        }
+    }
+
+    // Token of the cancellable task or TaskGroup task running on this
+    // thread, or a token that is never cancelled.
+    static const CancellationToken& current() {
+        static const CancellationToken none;
+        const CancellationToken* token = current_slot();
+        return token ? *token : none;
+    }
+};
+
+// Write side: cancel() flags every token obtained from this source or from
+// sources derived from it. Copies share the same flag.
+class CancellationSource {
+private:
+    std::shared_ptr<CancellationToken::State> state{std::make_shared<CancellationToken::State>()};
+
+public:
+    CancellationSource() = default;
+
+    // A source that is also cancelled when parent is.
+    explicit CancellationSource(const CancellationToken& parent) {
+        state->parent = parent.state;
+    }
+
+    void cancel() {
+        state->cancelled.store(true, std::memory_order_release);
+    }
+
+    bool is_cancelled() const {
+        return token().is_cancelled();
+    }
+
+    CancellationToken token() const {
+        return CancellationToken(state);
+    }
+};
+
+class TaskGraph;
+class TimerHandle;
+
+class LockFreeThreadPool {
+private:
+    friend class TaskGroup;
+    friend class TaskGraph;
+    friend class TimerHandle;
+    template<typename> friend class TaskFuture;
+
+    struct Task {
+        TaskFunction<> func;
+        Task* next{nullptr};
+        void (*dispose)(Task*) = &dispose_plain;
+        // Inherited from the task (or priority scope) that created this one.
+        TaskPriority priority{current_priority()};
+
+        static void dispose_plain(Task* task) {
+            task->~Task();
+            TaskSlab::deallocate(task);
+        }
+    };
+
+    // A task and the shared state of its future in one slab block. The task
+    // side holds one reference until it has run (or been discarded), the
+    // TaskFuture holds the other.
+    template<typename R>
+    struct PackagedTask final : Task, FutureState<R> {
+        PackagedTask() : FutureState<R>(2, &destroy_state) {
+            this->dispose = &dispose_packaged;
+        }
+
+        static void dispose_packaged(Task* task) {
+            auto* self = static_cast<PackagedTask*>(task);
+            self->func.reset();
+            if (!self->is_ready()) {
+                self->set_exception(std::make_exception_ptr(
+                    std::future_error(std::future_errc::broken_promise)));
+            }
+            self->release();
+        }
+
+        static void destroy_state(FutureStateBase* state) {
+            auto* self = static_cast<PackagedTask*>(static_cast<FutureState<R>*>(state));
+            self->~PackagedTask();
+            TaskSlab::deallocate(self);
+        }
+    };
+
+    // Continuation of a future: built by then(), scheduled on the pool when
+    // the source future completes. Holds the source's reference until run.
+    template<typename R, typename Source>
+    struct ThenTask final : Task, FutureState<R>, FutureStateBase::Continuation {
+        LockFreeThreadPool* pool{nullptr};
+        FutureState<Source>* source{nullptr};
+
+        ThenTask() : FutureState<R>(2, &destroy_state) {
+            this->dispose = &dispose_then;
+            this->fire = &fire_then;
+        }
+
+        static void fire_then(Continuation* c, FutureStateBase*) {
+            auto* self = static_cast<ThenTask*>(c);
+            self->pool->schedule(self);
+        }
+
+        static void dispose_then(Task* task) {
+            auto* self = static_cast<ThenTask*>(task);
+            self->func.reset();
+            if (self->source) {
+                std::exchange(self->source, nullptr)->release();
+            }
+            if (!self->is_ready()) {
+                self->set_exception(std::make_exception_ptr(
+                    std::future_error(std::future_errc::broken_promise)));
+            }
+            self->release();
+        }
+
+        static void destroy_state(FutureStateBase* state) {
+            auto* self = static_cast<ThenTask*>(static_cast<FutureState<R>*>(state));
+            self->~ThenTask();
+            TaskSlab::deallocate(self);
+        }
+    };
+
+    // Shared state behind enqueue_n(): the callable, a countdown of tasks that
+    // have not finished yet and the first exception any of them threw. Each
+    // task holds no reference of its own; the last one to finish drops the
+    // tasks' shared reference.
+    template<typename F>
+    struct BulkState final : FutureState<void> {
+        F func;
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed{false};
+
+        BulkState(F&& f, size_t count)
+            : FutureState<void>(2, &destroy_state), func(std::move(f)), remaining(count) {}
+
+        void record_exception(std::exception_ptr e) {
+            if (!failed.exchange(true, std::memory_order_acq_rel)) {
+                error = std::move(e);
+            }
+        }
+
+        void arrive() {
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                mark_ready();
+                release();
+            }
+        }
+
+        static void destroy_state(FutureStateBase* state) {
+            auto* self = static_cast<BulkState*>(static_cast<FutureState<void>*>(state));
+            self->~BulkState();
+            TaskSlab::deallocate(self);
+        }
+    };
+
+    template<typename F>
+    struct BulkTask final : Task {
+        BulkState<F>* group{nullptr};
+        size_t index{0};
+        bool ran{false};
+
+        BulkTask() {
+            this->dispose = &dispose_bulk;
+        }
+
+        static void dispose_bulk(Task* task) {
+            auto* self = static_cast<BulkTask*>(task);
+            BulkState<F>* group = self->group;
+            if (!self->ran) {
+                group->record_exception(std::make_exception_ptr(
+                    std::future_error(std::future_errc::broken_promise)));
+            }
+            self->~BulkTask();
+            TaskSlab::deallocate(self);
+            group->arrive();
+        }
+    };
+
+    // Shared by every range task of one parallel loop; lives on the caller's
+    // stack, which outlives the loop since the caller waits on latch. A loop
+    // type provides start() for a range task's local state, step(local, i)
+    // and finish(local) once the task's range is done.
+    struct LoopControl {
+        Latch latch{1};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+
+        void fail(std::exception_ptr e) {
+            if (!failed.exchange(true, std::memory_order_acq_rel)) {
+                error = std::move(e);
+            }
+        }
+    };
+
+    template<typename Body>
+    struct ForLoop : LoopControl {
+        struct Empty {};
+        Body& body;
+
+        explicit ForLoop(Body& b) : body(b) {}
+
+        Empty start() const { return {}; }
+
+        template<typename Index>
+        void step(Empty&, Index i) { body(i); }
+
+        void finish(Empty&, size_t) {}
+    };
+
+    // Each range task folds into a local accumulator and, when done, into the
+    // slot of the thread it ran on. Slots are only touched by their thread,
+    // so there is no shared counter; the caller combines them at the end.
+    // Past the workers' slots is one for the loop's caller, wherever it runs,
+    // and one shared under a lock by any other thread that ends up running a
+    // range.
+    template<typename T, typename Map, typename Combine>
+    struct ReduceLoop : LoopControl {
+        struct alignas(64) Partial {
+            T value;
+        };
+
+        const T& identity;
+        Map& map;
+        Combine& combine;
+        const size_t workers;
+        const std::thread::id caller{std::this_thread::get_id()};
+        std::mutex stray_mutex;
+        std::vector<Partial> partials;
+
+        ReduceLoop(const T& init, Map& m, Combine& c, size_t worker_slots)
+            : identity(init), map(m), combine(c), workers(worker_slots), partials(worker_slots + 2, Partial{init}) {}
+
+        T start() const { return identity; }
+
+        template<typename Index>
+        void step(T& local, Index i) { local = combine(std::move(local), map(i)); }
+
+        // slot is the worker index, or any larger value off the pool.
+        void finish(T& local, size_t slot) {
+            if (slot >= workers) {
+                if (std::this_thread::get_id() != caller) {
+                    std::lock_guard<std::mutex> lock(stray_mutex);
+                    fold(partials[workers + 1], local);
+                    return;
+                }
+                slot = workers;
+            }
+            fold(partials[slot], local);
+        }
+
+        void fold(Partial& partial, T& local) {
+            partial.value = combine(std::move(partial.value), std::move(local));
+        }
+
+        // Pairwise tree over the per-thread slots.
+        T join() {
+            for (size_t stride = 1; stride < partials.size(); stride *= 2) {
+                for (size_t i = 0; i + stride < partials.size(); i += 2 * stride) {
+                    partials[i].value = combine(std::move(partials[i].value), std::move(partials[i + stride].value));
+                }
+            }
+            return std::move(partials[0].value);
+        }
+    };
+
+    // A parallel_invoke() branch. It lives in the caller's frame, so disposing
+    // it only drops the callable and then counts down the caller's latch; the
+    // frame may be gone right after that.
+    struct InvokeTask : Task {
+        LoopControl* control{nullptr};
+
+        InvokeTask() {
+            this->dispose = &dispose_invoke;
+        }
+
+        static void dispose_invoke(Task* task) {
+            LoopControl* control = static_cast<InvokeTask*>(task)->control;
+            task->func.reset();
+            control->latch.count_down();
+        }
+    };
+
+    static constexpr size_t PRIORITY_LEVELS = 3;
+
+    // A timer in the wheel. One-shot timers carry the task to schedule when
+    // due; periodic ones a callback that every firing runs as a TimerTask,
+    // which puts the timer back into the wheel once it is done. The pool
+    // holds one reference while the timer is armed or running, a TimerHandle
+    // another. done is set once the timer will not fire again.
+    struct TimerNode : TimerWheel::Node {
+        LockFreeThreadPool* pool{nullptr};
+        Task* payload{nullptr};
+        TaskFunction<> callback;
+        uint64_t period{0};
+        TaskPriority priority{current_priority()};
+        std::atomic<uint32_t> refs{1};
+        std::atomic<bool> done{false};
+        // In the wheel; guarded by timer_mutex.
+        bool armed{false};
+
+        void release() {
+            if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                this->~TimerNode();
+                TaskSlab::deallocate(this);
+            }
+        }
+    };
+
+    struct TimerTask final : Task {
+        TimerNode* timer{nullptr};
+
+        TimerTask() {
+            this->dispose = &dispose_timer;
+        }
+
+        static void dispose_timer(Task* task) {
+            auto* self = static_cast<TimerTask*>(task);
+            TimerNode* timer = self->timer;
+            self->~TimerTask();
+            TaskSlab::deallocate(self);
+            timer->pool->rearm_timer(timer);
+        }
+    };
+
+    struct alignas(64) WorkerData {
+        static_assert(PRIORITY_LEVELS == 3, "one deque per level below");
+
+        WorkerData(size_t capacity, bool growable)
+            : local_queues{{WorkStealingDeque<Task>(capacity, growable), WorkStealingDeque<Task>(capacity, growable),
+                            WorkStealingDeque<Task>(capacity, growable)}} {}
+
+        std::array<WorkStealingDeque<Task>, PRIORITY_LEVELS> local_queues;
+        TaskSlab* task_slab{new TaskSlab};
+        // Tasks this worker has picked so far; drives aging.
+        size_t picks{0};
+        size_t node{0};
+        // CPU the worker is pinned to, -1 if it is not.
+        int cpu{-1};
+    };
+
+    // Per NUMA node (that has workers): one injection queue per level, the
+    // victims for stealing, own node first, and the node's CPUs.
+    struct NodeData {
+        std::array<InjectionQueue<Task>, PRIORITY_LEVELS> global_queues;
+        std::vector<size_t> workers;
+        std::vector<size_t> remote_workers;
+        std::vector<unsigned> cpus;
+    };
+
+    static constexpr size_t GLOBAL_BATCH_SIZE = 32;
+    // Every AGING_PERIOD-th pick scans the levels lowest first, so queued
+    // low-priority work still advances under a steady stream of urgent tasks.
+    static constexpr size_t AGING_PERIOD = 64;
+    static constexpr size_t SPIN_ROUNDS = 16;
+    // A worker waiting in run_tasks_until() with nothing to run parks on
+    // sleepers, where new tasks and the awaited completion wake it. The
+    // timeout only guards against a missed wake-up, e.g. when another pool's
+    // worker already holds the awaited object's helper slot: then the nap
+    // starts at WAIT_PARK_MIN and doubles up to WAIT_PARK_MAX.
+    static constexpr std::chrono::microseconds WAIT_PARK_MIN{20};
+    static constexpr std::chrono::microseconds WAIT_PARK_MAX{1000};
+    // Bulk submissions are published this many tasks at a time, so workers
+    // start on the first chunk while the rest is still being built.
+    static constexpr size_t BULK_CHUNK_SIZE = 256;
+
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<WorkerData>> worker_data;
+    QueueOverflow overflow{QueueOverflow::Grow};
+    std::atomic<bool> stop{false};
+
+    // Tasks enqueued but not yet finished (queued anywhere or running).
+    alignas(64) std::atomic<size_t> pending_count{0};
+
+    std::vector<std::unique_ptr<NodeData>> nodes;
+    // Pool node of each CPU id, for submissions from outside the pool.
+    std::vector<size_t> cpu_nodes;
+
+    // Deadline tasks, a min-heap on (deadline, submission order). Rarely hot,
+    // so a lock is enough; deadline_count lets workers skip it lock-free.
+    struct DeadlineEntry {
+        std::chrono::steady_clock::time_point deadline;
+        uint64_t sequence;
+        Task* task;
+
+        bool operator>(const DeadlineEntry& other) const {
+            return deadline != other.deadline ? deadline > other.deadline : sequence > other.sequence;
+        }
+    };
+
+    std::mutex deadline_mutex;
+    std::vector<DeadlineEntry> deadline_heap;
+    uint64_t deadline_sequence{0};
+    std::atomic<size_t> deadline_count{0};
+
+    static constexpr std::chrono::milliseconds TIMER_TICK{1};
+    // Busy workers look for due timers every this many picks.
+    static constexpr size_t TIMER_POLL_PERIOD = 8;
+
+    // Timers are fired by workers: busy ones poll between tasks, and one
+    // parked worker (the timekeeper) sleeps no longer than the next timer.
+    // timekeeper_due is the tick the timekeeper wakes at, NEVER if none is
+    // parked; a timer due earlier than that needs one more sleeper woken.
+    std::mutex timer_mutex;
+    TimerWheel timer_wheel;
+    bool timers_closed{false};
+    // Lower bound on the next due tick, for polling without the lock.
+    std::atomic<uint64_t> next_timer_tick{TimerWheel::NEVER};
+    std::atomic<uint64_t> timekeeper_due{TimerWheel::NEVER};
+    const std::chrono::steady_clock::time_point timer_epoch{std::chrono::steady_clock::now()};
+
+    // Task nodes allocated by threads outside the pool come from these,
+    // each behind a try-lock. A thread keeps to one lane while it is free,
+    // so concurrent producers settle on different lanes; when every lane is
+    // busy the node comes from the heap instead of waiting.
+    struct alignas(64) ExternalSlab {
+        std::atomic<bool> busy{false};
+        TaskSlab* slab{new TaskSlab};
+    };
+    static constexpr size_t EXTERNAL_SLABS = 8;
+    std::array<ExternalSlab, EXTERNAL_SLABS> external_slabs;
+
+    // Workers allocate their own WorkerData after pinning, so it is local to
+    // their node; nobody touches worker_data until all of them have.
+    Latch startup{0};
+
+    // Idle workers park here; every enqueue wakes at most one of them.
+    // Workers waiting on a future, latch or group park here as well and are
+    // woken by its completion, which may outlive the pool, hence the shared
+    // reference.
+    SharedEventCount& sleepers{*new SharedEventCount};
+    // Threads blocked in wait() park here until pending_count drops to zero.
+    EventCount drained;
+
+    // Receives exceptions escaping post()ed tasks. Read through atomic_load
+    // since it may be replaced while tasks are running.
+    std::shared_ptr<const std::function<void(std::exception_ptr)>> exception_handler;
+
+    static size_t& get_thread_id() {
+        static thread_local size_t id_val = std::numeric_limits<size_t>::max();
+        return id_val;
+    }
+
+    static const LockFreeThreadPool*& get_thread_pool() {
+        static thread_local const LockFreeThreadPool* pool_val = nullptr;
+        return pool_val;
+    }
+
+    // Index of the calling worker in this pool, or worker_data.size() when the
+    // caller is not one of our workers (external thread or another pool).
+    size_t current_worker_id() const {
+        return get_thread_pool() == this ? get_thread_id() : worker_data.size();
+    }
+
+    // Priority given to tasks created on this thread: that of the task being
+    // run, or the innermost PriorityScope.
+    static TaskPriority& current_priority() {
+        static thread_local TaskPriority priority_val = TaskPriority::Normal;
+        return priority_val;
+    }
+
+    struct PriorityScope {
+        TaskPriority saved;
+
+        explicit PriorityScope(TaskPriority priority) : saved(std::exchange(current_priority(), priority)) {}
+        ~PriorityScope() { current_priority() = saved; }
+    };
+
+    static size_t level_of(TaskPriority priority) {
+        return static_cast<size_t>(priority);
+    }
+
+    static std::mt19937& get_thread_rng() {
+        static thread_local std::mt19937 rng_val{std::random_device{}()};
+        return rng_val;
+    }
+
+    // A worker that is not pinned to a CPU is bound to node_cpus, if given,
+    // so that it stays on the node whose queues it serves.
+    void worker_thread(size_t id, size_t node, int cpu, std::vector<unsigned> node_cpus, size_t queue_capacity) {
+        if (cpu >= 0 && !bind_to_cpus({static_cast<unsigned>(cpu)})) {
+            cpu = -1;
+        }
+        if (cpu < 0 && !node_cpus.empty()) {
+            bind_to_cpus(node_cpus);
+        }
+        worker_data[id] = std::make_unique<WorkerData>(queue_capacity, overflow == QueueOverflow::Grow);
+        worker_data[id]->node = node;
+        worker_data[id]->cpu = cpu;
+        startup.count_down();
+        startup.wait();
+
+        get_thread_id() = id;
+        get_thread_pool() = this;
+        auto& data = *worker_data[id];
+        TaskSlab::thread_slab() = data.task_slab;
+        FutureStateBase::thread_wait_helper() = {&help_until_ready, this};
+        size_t idle_rounds = 0;
+
+        while (!stop.load(std::memory_order_acquire)) {
+            Task* task = find_task(data, id);
+
+            if (task) {
+                run_task(task);
+                idle_rounds = 0;
+            } else if (poll_timers()) {
+                idle_rounds = 0;
+            } else if (++idle_rounds < SPIN_ROUNDS) {
+                std::this_thread::yield();
+            } else {
+                park();
+                idle_rounds = 0;
+            }
+        }
+
+        FutureStateBase::thread_wait_helper() = {};
+        TaskSlab::thread_slab() = nullptr;
+    }
+
+    static void help_until_ready(void* context, FutureStateBase& state) {
+        static_cast<LockFreeThreadPool*>(context)->run_tasks_until(
+            [&state]() { return state.is_ready(); },
+            [&state](SharedEventCount& sleepers) { return state.add_helper(sleepers); });
+    }
+
+    void park() {
+        uint32_t key = sleepers.prepare_wait();
+        if (stop.load(std::memory_order_acquire) || has_queued_work()) {
+            sleepers.cancel_wait();
+            return;
+        }
+        uint64_t due = next_timer_tick.load(std::memory_order_acquire);
+        uint64_t covered = timekeeper_due.load();
+        if (due >= covered || !timekeeper_due.compare_exchange_strong(covered, due)) {
+            sleepers.commit_wait(key);
+            return;
+        }
+        auto timeout = timer_epoch + static_cast<std::chrono::milliseconds::rep>(due) * TIMER_TICK -
+                       std::chrono::steady_clock::now();
+        if (timeout.count() > 0) {
+            sleepers.commit_wait_for(key, timeout);
+        } else {
+            sleepers.cancel_wait();
+        }
+        timekeeper_due.compare_exchange_strong(due, TimerWheel::NEVER);
+    }
+
+    bool has_queued_work() const {
+        if (deadline_count.load(std::memory_order_acquire) != 0) {
+            return true;
+        }
+        for (size_t level = 0; level < PRIORITY_LEVELS; ++level) {
+            for (const auto& node : nodes) {
+                if (!node->global_queues[level].empty()) {
+                    return true;
+                }
+            }
+            for (const auto& data : worker_data) {
+                if (!data->local_queues[level].empty()) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Deadline tasks first, earliest deadline first. Then level by level,
+    // highest first: own deque, then the own node's global queue, then other
+    // workers' deques and remote global queues of that level, so queued
+    // high-priority work anywhere runs before local lower-priority work. An
+    // aged pick goes lowest level first and takes deadline tasks last.
+    Task* find_task(WorkerData& data, size_t id) {
+        if (data.picks % TIMER_POLL_PERIOD == 0) {
+            poll_timers();
+        }
+        bool aged = data.picks % AGING_PERIOD == AGING_PERIOD - 1;
+        Task* task = aged ? nullptr : pop_deadline_task();
+        for (size_t i = 0; i < PRIORITY_LEVELS && !task; ++i) {
+            size_t level = aged ? PRIORITY_LEVELS - 1 - i : i;
+            if (!data.local_queues[level].empty()) {
+                task = data.local_queues[level].pop();
+            }
+            if (!task) {
+                task = steal_from_global(data, *nodes[data.node], level);
+            }
+            if (!task) {
+                task = steal_from_others(id, level);
+            }
+        }
+        if (!task) {
+            task = pop_deadline_task();
+        }
+        if (task) {
+            ++data.picks;
+        }
+        return task;
+    }
+
+    // nullptr if every external slab is in use.
+    ExternalSlab* claim_external_slab() {
+        static thread_local size_t lane = std::hash<std::thread::id>{}(std::this_thread::get_id());
+        for (size_t i = 0; i < EXTERNAL_SLABS; ++i) {
+            ExternalSlab& external = external_slabs[(lane + i) % EXTERNAL_SLABS];
+            if (!external.busy.load(std::memory_order_relaxed) &&
+                !external.busy.exchange(true, std::memory_order_acquire)) {
+                lane += i;
+                return &external;
+            }
+        }
+        return nullptr;
+    }
+
+    // Worker's own slab, or an external one for other threads.
+    void* allocate_node(size_t bytes, size_t alignment) {
+        size_t id = current_worker_id();
+        if (id < worker_data.size()) {
+            return worker_data[id]->task_slab->allocate(bytes, alignment);
+        }
+        ExternalSlab* external = claim_external_slab();
+        if (!external) {
+            return TaskSlab::allocate_unowned(bytes);
+        }
+        void* memory = external->slab->allocate(bytes, alignment);
+        external->busy.store(false, std::memory_order_release);
+        return memory;
+    }
+
+    template<typename T>
+    T* allocate_task() {
+        return new (allocate_node(sizeof(T), alignof(T))) T();
+    }
+
+    // The task enqueue() schedules, not yet scheduled. Unless guard is
+    // nullptr, it is called first, and an exception it returns is stored in
+    // the future instead of running the body.
+    template<typename Guard, typename F, typename... Args>
+    auto make_packaged_task(Guard guard, F&& f, Args&&... args) {
+        using return_type = typename std::invoke_result<F, Args...>::type;
+
+        auto task = allocate_task<PackagedTask<return_type>>();
+        task->set_executor_pool(this);
+        FutureState<return_type>* state = task;
+
+        task->func = [state,
+                      guard,
+                      func = std::forward<F>(f),
+                      bound_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            if constexpr (!std::is_null_pointer_v<Guard>) {
+                if (std::exception_ptr skipped = guard()) {
+                    state->set_exception(std::move(skipped));
+                    return;
+                }
+            }
+            try {
+                if constexpr (std::is_void_v<return_type>) {
+                    std::apply(std::move(func), std::move(bound_args));
+                    state->set_value();
+                } else {
+                    state->set_value(std::apply(std::move(func), std::move(bound_args)));
+                }
+            } catch (...) {
+                state->set_exception(std::current_exception());
+            }
+        };
+        return task;
+    }
+
+    // The task post() schedules, not yet scheduled.
+    template<typename F, typename... Args>
+    Task* make_posted_task(F&& f, Args&&... args) {
+        auto task = allocate_task<Task>();
+
+        task->func = [this,
+                      func = std::forward<F>(f),
+                      bound_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            try {
+                std::apply(std::move(func), std::move(bound_args));
+            } catch (...) {
+                report_exception(std::current_exception());
+            }
+        };
+        return task;
+    }
+
+    template<typename R, typename F, typename... Args>
+    static void fulfil(FutureState<R>* state, F& func, Args&&... args) {
+        if constexpr (std::is_void_v<R>) {
+            std::invoke(func, std::forward<Args>(args)...);
+            state->set_value();
+        } else {
+            state->set_value(std::invoke(func, std::forward<Args>(args)...));
+        }
+    }
+
+    template<typename Source, typename F>
+    auto chain(FutureState<Source>* source, F&& f) -> TaskFuture<then_result_t<std::decay_t<F>&, Source>> {
+        using return_type = then_result_t<std::decay_t<F>&, Source>;
+
+        auto task = allocate_task<ThenTask<return_type, Source>>();
+        task->pool = this;
+        task->source = source;
+        task->set_executor_pool(this);
+        task->func = [task, func = std::forward<F>(f)]() mutable {
+            FutureState<Source>* input = std::exchange(task->source, nullptr);
+            try {
+                if constexpr (std::is_void_v<Source>) {
+                    input->take();
+                    fulfil<return_type>(task, func);
+                } else {
+                    fulfil<return_type>(task, func, input->take());
+                }
+            } catch (...) {
+                task->set_exception(std::current_exception());
+            }
+            input->release();
+        };
+
+        FutureState<return_type>* state = task;
+        source->add_continuation(task);
+        return TaskFuture<return_type>(state);
+    }
+
+    // Fills out with count default-constructed nodes, claiming an external
+    // slab at most once.
+    template<typename T>
+    void allocate_tasks(T** out, size_t count) {
+        size_t id = current_worker_id();
+        ExternalSlab* external = id < worker_data.size() ? nullptr : claim_external_slab();
+        TaskSlab* slab = id < worker_data.size() ? worker_data[id]->task_slab
+                                                 : external ? external->slab : nullptr;
+        for (size_t i = 0; i < count; ++i) {
+            void* memory = slab ? slab->allocate(sizeof(T), alignof(T)) : TaskSlab::allocate_unowned(sizeof(T));
+            out[i] = new (memory) T();
+        }
+        if (external) {
+            external->busy.store(false, std::memory_order_release);
+        }
+    }
+
+    // Node whose injection queue takes overflow from the calling thread: a
+    // worker's own, or for outside threads the node of the CPU it runs on.
+    size_t submit_node(size_t id) const {
+        if (id < worker_data.size()) {
+            return worker_data[id]->node;
+        }
+        if (nodes.size() == 1) {
+            return 0;
+        }
+#if defined(__linux__)
+        int cpu = sched_getcpu();
+        if (cpu >= 0 && static_cast<size_t>(cpu) < cpu_nodes.size()) {
+            return cpu_nodes[static_cast<size_t>(cpu)];
+        }
+#endif
+        return 0;
+    }
+
+    void schedule(Task* task) {
+        pending_count.fetch_add(1, std::memory_order_relaxed);
+
+        size_t id = current_worker_id();
+        size_t level = level_of(task->priority);
+        if (id >= worker_data.size() || !worker_data[id]->local_queues[level].push(task)) {
+            if (id < worker_data.size() && overflow == QueueOverflow::RunInline) {
+                run_task(task);
+                return;
+            }
+            nodes[submit_node(id)]->global_queues[level].push(task);
+        }
+
+        sleepers.notify_one();
+    }
+
+    // Publishes a whole batch: one bottom store on the local deque (workers) or
+    // one ring claim on the global queue, then wakes at most one sleeper per
+    // task. The batch goes to the level of its first task.
+    void schedule_bulk(Task* const* tasks, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        pending_count.fetch_add(count, std::memory_order_relaxed);
+
+        size_t id = current_worker_id();
+        size_t level = level_of(tasks[0]->priority);
+        size_t pushed = id < worker_data.size() ? worker_data[id]->local_queues[level].push_bulk(tasks, count) : 0;
+        if (pushed < count && id < worker_data.size() && overflow == QueueOverflow::RunInline) {
+            sleepers.notify_many(pushed);
+            for (size_t i = pushed; i < count; ++i) {
+                run_task(tasks[i]);
+            }
+            return;
+        }
+        if (pushed < count) {
+            nodes[submit_node(id)]->global_queues[level].push_bulk(tasks + pushed, count - pushed);
+        }
+
+        sleepers.notify_many(count);
+    }
+
+    // Lazy splitting hint: only worth splitting when an idle worker is parked
+    // and the caller has nothing queued that it could steal instead.
+    bool should_split() const {
+        if (sleepers.waiting() == 0) {
+            return false;
+        }
+        size_t id = current_worker_id();
+        size_t level = level_of(current_priority());
+        return id < worker_data.size() ? worker_data[id]->local_queues[level].empty()
+                                       : nodes[submit_node(id)]->global_queues[level].empty();
+    }
+
+    // Runs [lo, hi) and hands the upper half of whatever is left to the pool
+    // each time should_split() says a thief is idle.
+    template<typename Index, typename Loop>
+    void run_range(Loop& loop, Index lo, Index hi) {
+        try {
+            auto local = loop.start();
+            while (lo < hi && !loop.failed.load(std::memory_order_relaxed)) {
+                if (hi - lo > 1 && should_split()) {
+                    Index mid = lo + (hi - lo) / 2;
+                    auto task = allocate_task<Task>();
+                    task->func = [this, &loop, mid, hi]() {
+                        run_range(loop, mid, hi);
+                    };
+                    loop.latch.count_up();
+                    schedule(task);
+                    hi = mid;
+                    continue;
+                }
+                loop.step(local, lo);
+                ++lo;
+            }
+            loop.finish(local, current_worker_id());
+        } catch (...) {
+            loop.fail(std::current_exception());
+        }
+        loop.latch.count_down();
+    }
+
+    // Runs the root range on the calling thread, then waits for the split
+    // tasks (helping out if the caller is a worker) and rethrows the first
+    // exception.
+    template<typename Index, typename Loop>
+    void run_loop(Loop& loop, Index begin, Index end) {
+        run_range(loop, begin, end);
+
+        if (current_worker_id() < worker_data.size()) {
+            run_tasks_until(loop.latch);
+        } else {
+            loop.latch.wait();
+        }
+
+        if (loop.error) {
+            std::rethrow_exception(loop.error);
+        }
+    }
+
+    template<typename Branches, size_t... I>
+    static void bind_branches(InvokeTask* tasks, LoopControl& control, Branches& branches,
+                              std::index_sequence<I...>) {
+        ((tasks[I].control = &control,
+          tasks[I].func = [&control, &f = std::get<I>(branches)]() {
+              try {
+                  f();
+              } catch (...) {
+                  control.fail(std::current_exception());
+              }
+          }), ...);
+    }
+
+    // A worker waiting on work it spawned must keep executing tasks: the work
+    // may sit in its own deque, and if every worker blocked nothing would run
+    // it. Runs tasks (own deque, then global queue, then stealing) until
+    // done() returns true. With nothing to run it spins briefly, then parks
+    // on the pool's event count; arm(sleepers) registers it with the awaited
+    // object so that completion wakes it, and returns false if it could not.
+    template<typename Predicate, typename Arm>
+    void run_tasks_until(Predicate done, Arm arm) {
+        size_t id = current_worker_id();
+        auto& data = *worker_data[id];
+        size_t idle_rounds = 0;
+        std::chrono::microseconds nap = WAIT_PARK_MIN;
+        while (!done()) {
+            Task* task = find_task(data, id);
+            if (task) {
+                run_task(task);
+                idle_rounds = 0;
+                nap = WAIT_PARK_MIN;
+            } else if (poll_timers()) {
+                idle_rounds = 0;
+            } else if (++idle_rounds < SPIN_ROUNDS) {
+                std::this_thread::yield();
+            } else {
+                uint32_t key = sleepers.prepare_wait();
+                bool armed = arm(sleepers);
+                if (done() || has_queued_work()) {
+                    sleepers.cancel_wait();
+                } else if (armed) {
+                    sleepers.commit_wait_for(key, WAIT_PARK_MAX);
+                } else {
+                    sleepers.commit_wait_for(key, nap);
+                    nap = std::min(nap * 2, WAIT_PARK_MAX);
+                }
+            }
+        }
+    }
+
+    void run_tasks_until(Latch& latch) {
+        run_tasks_until([&latch]() { return latch.try_wait(); },
+                        [&latch](SharedEventCount& sleepers) { return latch.add_helper(sleepers); });
+    }
+
+    void report_exception(std::exception_ptr error) {
+        auto handler = std::atomic_load(&exception_handler);
+        if (handler && *handler) {
+            (*handler)(std::move(error));
+        }
+    }
+
+    void run_task(Task* task) {
+        {
+            PriorityScope scope(task->priority);
+            task->func();
+        }
+        task->dispose(task);
+        finish_task();
+    }
+
+    void finish_task() {
+        if (pending_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            drained.notify_all();
+        }
+    }
+
+    // Takes a fair share of the oldest tasks in a node's global queue in one
+    // claim. The first one is returned to run now; the rest go to the local
+    // deque in reverse so that LIFO pops still run them in submission order.
+    // The claim is capped by the deque's room: putting leftovers back would
+    // queue them behind newer tasks.
+    Task* steal_from_global(WorkerData& data, NodeData& node, size_t level) {
+        auto& queue = node.global_queues[level];
+        if (queue.empty()) {
+            return nullptr;
+        }
+        auto& local = data.local_queues[level];
+        size_t share = queue.size() / node.workers.size() + 1;
+        // One to run now plus what the deque can take.
+        size_t limit = std::min(std::min(share, GLOBAL_BATCH_SIZE) - 1, local.room()) + 1;
+        Task* batch[GLOBAL_BATCH_SIZE];
+        size_t count = queue.pop_bulk(batch, limit);
+        if (count == 0) {
+            return nullptr;
+        }
+
+        for (size_t j = count; j-- > 1;) {
+            if (!local.push(batch[j])) {
+                // Only if growing the deque ran out of memory.
+                queue.push(batch[j]);
+            }
+        }
+        return batch[0];
+    }
+
+    void schedule_deadline(Task* task, std::chrono::steady_clock::time_point deadline) {
+        pending_count.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(deadline_mutex);
+            deadline_heap.push_back({deadline, deadline_sequence++, task});
+            std::push_heap(deadline_heap.begin(), deadline_heap.end(), std::greater<>{});
+            deadline_count.fetch_add(1, std::memory_order_release);
+        }
+        sleepers.notify_one();
+    }
+
+    Task* pop_deadline_task() {
+        if (deadline_count.load(std::memory_order_acquire) == 0) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(deadline_mutex);
+        if (deadline_heap.empty()) {
+            return nullptr;
+        }
+        std::pop_heap(deadline_heap.begin(), deadline_heap.end(), std::greater<>{});
+        Task* task = deadline_heap.back().task;
+        deadline_heap.pop_back();
+        deadline_count.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+    }
+
+    uint64_t current_tick() const {
+        return static_cast<uint64_t>((std::chrono::steady_clock::now() - timer_epoch) / TIMER_TICK);
+    }
+
+    // First tick not before when, so that timers never fire early.
+    uint64_t tick_at(std::chrono::steady_clock::time_point when) const {
+        if (when <= timer_epoch) {
+            return 0;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(when - timer_epoch);
+        return static_cast<uint64_t>((elapsed + TIMER_TICK - std::chrono::nanoseconds(1)) / TIMER_TICK);
+    }
+
+    TimerNode* new_timer(uint64_t due, uint32_t refs) {
+        auto timer = allocate_task<TimerNode>();
+        timer->pool = this;
+        timer->due = due;
+        timer->refs.store(refs, std::memory_order_relaxed);
+        return timer;
+    }
+
+    // Caller holds timer_mutex. Returns true if the timer may now be the
+    // earliest one, in which case wake_timekeeper() has to be called.
+    bool insert_timer(TimerNode* timer) {
+        timer_wheel.reset(current_tick());
+        timer_wheel.insert(timer);
+        timer->armed = true;
+        uint64_t next = timer_wheel.next_event();
+        if (next < next_timer_tick.load(std::memory_order_relaxed)) {
+            next_timer_tick.store(next, std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+    // Puts a new timer into the wheel; the timer may fire and be gone by
+    // the time this returns.
+    void arm_timer(TimerNode* timer) {
+        bool armed = false;
+        bool earlier = false;
+        {
+            std::lock_guard<std::mutex> lock(timer_mutex);
+            if (!timers_closed) {
+                earlier = insert_timer(timer);
+                armed = true;
+            }
+        }
+        if (!armed) {
+            timer->done.store(true, std::memory_order_release);
+            discard_timer(timer);
+        } else if (earlier) {
+            wake_timekeeper();
+        }
+    }
+
+    // Wakes a single sleeper if no parked timekeeper would wake in time for
+    // the earliest timer; it parks again as timekeeper for that tick. A
+    // periodic timer's rearm thus costs at most one wake-up.
+    void wake_timekeeper() {
+        if (next_timer_tick.load() < timekeeper_due.load()) {
+            sleepers.notify_one();
+        }
+    }
+
+    // A periodic timer whose run has finished: back into the wheel one
+    // period after its last due tick, or released if it was cancelled.
+    void rearm_timer(TimerNode* timer) {
+        bool armed = false;
+        bool earlier = false;
+        {
+            std::lock_guard<std::mutex> lock(timer_mutex);
+            if (!timers_closed && !timer->done.load(std::memory_order_acquire)) {
+                timer->due = std::max(timer->due + timer->period, current_tick());
+                earlier = insert_timer(timer);
+                armed = true;
+            }
+        }
+        if (!armed) {
+            timer->done.store(true, std::memory_order_release);
+            discard_timer(timer);
+        } else if (earlier) {
+            wake_timekeeper();
+        }
+    }
+
+    // Called once done has been set by the canceller; drops the timer if it
+    // is still in the wheel, otherwise whoever holds it sees done.
+    void cancel_timer(TimerNode* timer) {
+        bool was_armed;
+        {
+            std::lock_guard<std::mutex> lock(timer_mutex);
+            was_armed = timer->armed;
+            if (was_armed) {
+                timer_wheel.remove(timer);
+                timer->armed = false;
+            }
+        }
+        if (was_armed) {
+            discard_timer(timer);
+        }
+    }
+
+    void discard_timer(TimerNode* timer) {
+        if (Task* payload = std::exchange(timer->payload, nullptr)) {
+            payload->dispose(payload);
+        }
+        timer->release();
+    }
+
+    void fire_timer(TimerNode* timer) {
+        if (timer->period == 0) {
+            if (timer->done.exchange(true, std::memory_order_acq_rel)) {
+                discard_timer(timer);
+                return;
+            }
+            schedule(std::exchange(timer->payload, nullptr));
+            timer->release();
+            return;
+        }
+
+        auto task = allocate_task<TimerTask>();
+        task->timer = timer;
+        task->priority = timer->priority;
+        task->func = [this, timer]() {
+            // Cancelled after it fired but before this run started.
+            if (timer->done.load(std::memory_order_acquire)) {
+                return;
+            }
+            try {
+                timer->callback();
+            } catch (...) {
+                report_exception(std::current_exception());
+            }
+        };
+        schedule(task);
+    }
+
+    // Fires every timer that is due. Returns true if any did.
+    bool poll_timers() {
+        uint64_t due = next_timer_tick.load(std::memory_order_acquire);
+        if (due == TimerWheel::NEVER) {
+            return false;
+        }
+        uint64_t now = current_tick();
+        if (now < due) {
+            return false;
+        }
+
+        TimerWheel::Node* fired = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(timer_mutex, std::try_to_lock);
+            if (!lock.owns_lock()) {
+                return false;
+            }
+            timer_wheel.advance(now, [&fired](TimerWheel::Node* node) {
+                static_cast<TimerNode*>(node)->armed = false;
+                node->next = fired;
+                fired = node;
+            });
+            next_timer_tick.store(timer_wheel.next_event(), std::memory_order_release);
+        }
+
+        bool any = fired != nullptr;
+        while (fired) {
+            auto* timer = static_cast<TimerNode*>(fired);
+            fired = fired->next;
+            fire_timer(timer);
+        }
+        return any;
+    }
+
+    // Drops every armed timer; timers running now are dropped when they
+    // finish.
+    void close_timers() {
+        TimerWheel::Node* armed = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(timer_mutex);
+            timers_closed = true;
+            timer_wheel.clear([&armed](TimerWheel::Node* node) {
+                static_cast<TimerNode*>(node)->armed = false;
+                node->next = armed;
+                armed = node;
+            });
+            next_timer_tick.store(TimerWheel::NEVER, std::memory_order_release);
+        }
+        while (armed) {
+            auto* timer = static_cast<TimerNode*>(armed);
+            armed = armed->next;
+            timer->done.store(true, std::memory_order_release);
+            discard_timer(timer);
+        }
+    }
+
+    // Random victims on the thief's own node first. Only once those attempts
+    // came up empty does it go remote: the other nodes' global queues, then
+    // their workers.
+    Task* steal_from_others(size_t thief_id, size_t level) {
+        WorkerData& data = *worker_data[thief_id];
+        const NodeData& node = *nodes[data.node];
+        if (Task* task = steal_from(node.workers, thief_id, level)) {
+            return task;
+        }
+        for (size_t i = 1; i < nodes.size(); ++i) {
+            if (Task* task = steal_from_global(data, *nodes[(data.node + i) % nodes.size()], level)) {
+                return task;
+            }
+        }
+        return node.remote_workers.empty() ? nullptr : steal_from(node.remote_workers, thief_id, level);
+    }
+
+    // Takes half of a random victim's deque: one task to run now, the rest
+    // moved to the thief's own deque, where other idle workers can steal
+    // them in turn.
+    Task* steal_from(const std::vector<size_t>& victims, size_t thief_id, size_t level) {
+        size_t victim_count = victims.size();
+        std::uniform_int_distribution<size_t> dist(0, victim_count - 1);
+        auto& own = worker_data[thief_id]->local_queues[level];
+
+        for (size_t attempts = 0; attempts < victim_count * 2; ++attempts) {
+            size_t victim_id = victims[dist(get_thread_rng())];
+            auto& victim = worker_data[victim_id]->local_queues[level];
+            // Levels are probed on every pick, mostly empty; skip those
+            // without the fence steal() pays.
+            if (victim_id == thief_id || victim.empty()) continue;
+
+            Task* task = victim.steal_half(own);
+            if (task) {
+                if (!own.empty()) {
+                    sleepers.notify_one();
+                }
+                return task;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Restricts the calling thread to cpus.
+    static bool bind_to_cpus(const std::vector<unsigned>& cpus) {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (unsigned cpu : cpus) {
+            if (cpu >= CPU_SETSIZE) {
+                return false;
+            }
+            CPU_SET(cpu, &set);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpus;
+        return false;
+#endif
+    }
+
+    // Groups the workers by the node of their CPU and returns each worker's
+    // pool node. Only nodes with workers get a NodeData.
+    std::vector<size_t> assign_nodes(const CpuTopology& topology, const std::vector<unsigned>& worker_cpus) {
+        std::vector<size_t> topology_node;
+        for (size_t n = 0; n < topology.nodes.size(); ++n) {
+            for (unsigned cpu : topology.nodes[n]) {
+                if (cpu >= topology_node.size()) {
+                    topology_node.resize(cpu + 1, 0);
+                }
+                topology_node[cpu] = n;
+            }
+        }
+
+        std::vector<size_t> pool_node(std::max<size_t>(1, topology.nodes.size()), SIZE_MAX);
+        std::vector<size_t> worker_nodes(worker_cpus.size());
+        for (size_t i = 0; i < worker_cpus.size(); ++i) {
+            size_t n = worker_cpus[i] < topology_node.size() ? topology_node[worker_cpus[i]] : 0;
+            if (pool_node[n] == SIZE_MAX) {
+                pool_node[n] = nodes.size();
+                nodes.push_back(std::make_unique<NodeData>());
+                if (n < topology.nodes.size()) {
+                    nodes.back()->cpus = topology.nodes[n];
+                }
+            }
+            worker_nodes[i] = pool_node[n];
+            nodes[pool_node[n]]->workers.push_back(i);
+        }
+        if (nodes.empty()) {
+            nodes.push_back(std::make_unique<NodeData>());
+        }
+
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            for (size_t i = 0; i < worker_nodes.size(); ++i) {
+                if (worker_nodes[i] != n) {
+                    nodes[n]->remote_workers.push_back(i);
+                }
+            }
+        }
+        cpu_nodes.resize(topology_node.size());
+        for (size_t cpu = 0; cpu < topology_node.size(); ++cpu) {
+            size_t n = pool_node[topology_node[cpu]];
+            cpu_nodes[cpu] = n == SIZE_MAX ? 0 : n;
+        }
+        return worker_nodes;
+    }
+
+public:
+    explicit LockFreeThreadPool(size_t num_threads = CpuQuota::detected())
+        : LockFreeThreadPool([num_threads]() {
+              ThreadPoolOptions options;
+              options.num_threads = num_threads;
+              return options;
+          }()) {}
+
+    explicit LockFreeThreadPool(const ThreadPoolOptions& options) : startup(options.num_threads) {
+        size_t num_threads = options.num_threads;
+        worker_data.resize(num_threads);
+        threads.reserve(num_threads);
+
+        CpuTopology topology = options.topology.nodes.empty()
+                                   ? CpuTopology::from_sysfs().restricted_to(CpuTopology::allowed_cpus())
+                                   : options.topology;
+        std::vector<unsigned> cpus;
+        if (options.placement == ThreadPlacement::Explicit) {
+            for (size_t i = 0; i < num_threads && !options.cpus.empty(); ++i) {
+                cpus.push_back(options.cpus[i % options.cpus.size()]);
+            }
+            cpus.resize(num_threads);
+        } else {
+            cpus = topology.place(options.placement, num_threads);
+        }
+        std::vector<size_t> worker_nodes = assign_nodes(topology, cpus);
+        overflow = options.local_queue_overflow;
+
+        // Workers that are not pinned are still bound to their node's CPUs;
+        // otherwise node-local queues and stealing would mean nothing.
+        bool pin = options.placement != ThreadPlacement::None &&
+                   !(options.placement == ThreadPlacement::Explicit && options.cpus.empty());
+        for (size_t i = 0; i < num_threads; ++i) {
+            threads.emplace_back(&LockFreeThreadPool::worker_thread, this, i, worker_nodes[i],
+                                 pin ? static_cast<int>(cpus[i]) : -1,
+                                 nodes.size() > 1 ? nodes[worker_nodes[i]]->cpus : std::vector<unsigned>{},
+                                 options.local_queue_capacity);
+        }
+        startup.wait();
+    }
+
+    ~LockFreeThreadPool() {
+        close_timers();
+        wait();
+
+        stop.store(true, std::memory_order_release);
+        sleepers.notify_all();
+
+        for (auto& thread : threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+
+        for (auto& node : nodes) {
+            for (auto& queue : node->global_queues) {
+                while (Task* task = queue.pop()) {
+                    task->dispose(task);
+                }
+            }
+        }
+        for (auto& entry : deadline_heap) {
+            entry.task->dispose(entry.task);
+        }
+
+        for (auto& data : worker_data) {
+            TaskSlab::retire(data->task_slab);
+        }
+        for (auto& external : external_slabs) {
+            TaskSlab::retire(external.slab);
+        }
+        sleepers.release();
+    }
+
+    template<typename F, typename... Args>
+    auto enqueue(F&& f, Args&&... args) -> TaskFuture<typename std::invoke_result<F, Args...>::type> {
+        using return_type = typename std::invoke_result<F, Args...>::type;
+
+        auto task = make_packaged_task(nullptr, std::forward<F>(f), std::forward<Args>(args)...);
+        FutureState<return_type>* state = task;
+        schedule(task);
+        return TaskFuture<return_type>(state);
+    }
+
+    // Like enqueue(), but the task is not scheduled before when (1 ms
+    // resolution). Timers wait in a hierarchical wheel with O(1) insert and
+    // cancel, and are fired by the workers themselves. wait() does not wait
+    // for timers that have not fired yet; destroying the pool drops them and
+    // their futures throw broken_promise.
+    template<typename F, typename... Args>
+    auto enqueue_at(std::chrono::steady_clock::time_point when, F&& f, Args&&... args)
+        -> TaskFuture<typename std::invoke_result<F, Args...>::type> {
+        using return_type = typename std::invoke_result<F, Args...>::type;
+
+        auto task = make_packaged_task(nullptr, std::forward<F>(f), std::forward<Args>(args)...);
+        FutureState<return_type>* state = task;
+        TimerNode* timer = new_timer(tick_at(when), 1);
+        timer->payload = task;
+        arm_timer(timer);
+        return TaskFuture<return_type>(state);
+    }
+
+    template<typename Rep, typename Period, typename F, typename... Args>
+    auto enqueue_after(std::chrono::duration<Rep, Period> delay, F&& f, Args&&... args) {
+        return enqueue_at(std::chrono::steady_clock::now() + delay, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    // post() after delay, with a handle to cancel it.
+    template<typename Rep, typename Period, typename F>
+    TimerHandle post_after(std::chrono::duration<Rep, Period> delay, F&& f);
+
+    // Runs f every period, the first time one period from now, until the
+    // returned handle is cancelled or the pool is destroyed. A run that
+    // overlaps its next due time delays it rather than running twice.
+    template<typename Rep, typename Period, typename F>
+    TimerHandle schedule_every(std::chrono::duration<Rep, Period> period, F&& f);
+
+    // Enqueues every callable in [first, last), BULK_CHUNK_SIZE tasks per
+    // publish, and returns their futures in the same order. The range is
+    // measured first, so it has to be multi-pass.
+    template<typename ForwardIt>
+    auto enqueue_bulk(ForwardIt first, ForwardIt last)
+        -> std::vector<TaskFuture<std::invoke_result_t<typename std::iterator_traits<ForwardIt>::value_type&>>> {
+        static_assert(std::is_base_of_v<std::forward_iterator_tag,
+                                        typename std::iterator_traits<ForwardIt>::iterator_category>,
+                      "enqueue_bulk needs forward iterators");
+        using F = typename std::iterator_traits<ForwardIt>::value_type;
+        using return_type = std::invoke_result_t<F&>;
+
+        size_t remaining = static_cast<size_t>(std::distance(first, last));
+        std::vector<TaskFuture<return_type>> futures;
+        futures.reserve(remaining);
+
+        PackagedTask<return_type>* chunk[BULK_CHUNK_SIZE];
+        Task* batch[BULK_CHUNK_SIZE];
+        while (remaining > 0) {
+            size_t count = std::min(remaining, BULK_CHUNK_SIZE);
+            allocate_tasks(chunk, count);
+            for (size_t i = 0; i < count; ++i) {
+                chunk[i]->set_executor_pool(this);
+                FutureState<return_type>* state = chunk[i];
+                chunk[i]->func = [state, func = F(*first++)]() mutable {
+                    try {
+                        if constexpr (std::is_void_v<return_type>) {
+                            func();
+                            state->set_value();
+                        } else {
+                            state->set_value(func());
+                        }
+                    } catch (...) {
+                        state->set_exception(std::current_exception());
+                    }
+                };
+                futures.emplace_back(state);
+                batch[i] = chunk[i];
+            }
+            schedule_bulk(batch, count);
+            remaining -= count;
+        }
+        return futures;
+    }
+
+    // Runs f(i) for every i in [0, count) as count separate tasks published in
+    // batches. The returned future becomes ready once all of them finished
+    // and rethrows the first exception any of them threw.
+    template<typename F>
+    TaskFuture<void> enqueue_n(size_t count, F&& f) {
+        using Fn = std::decay_t<F>;
+        using State = BulkState<Fn>;
+
+        State* group = new (allocate_node(sizeof(State), alignof(State))) State(Fn(std::forward<F>(f)), count);
+
+        group->set_executor_pool(this);
+        if (count == 0) {
+            group->set_value();
+            group->release();
+            return TaskFuture<void>(group);
+        }
+
+        BulkTask<Fn>* chunk[BULK_CHUNK_SIZE];
+        Task* batch[BULK_CHUNK_SIZE];
+        for (size_t begin = 0; begin < count; begin += BULK_CHUNK_SIZE) {
+            size_t size = std::min(count - begin, BULK_CHUNK_SIZE);
+            allocate_tasks(chunk, size);
+            for (size_t i = 0; i < size; ++i) {
+                BulkTask<Fn>* task = chunk[i];
+                task->group = group;
+                task->index = begin + i;
+                task->func = [task]() {
+                    task->ran = true;
+                    try {
+                        task->group->func(task->index);
+                    } catch (...) {
+                        task->group->record_exception(std::current_exception());
+                    }
+                };
+                batch[i] = task;
+            }
+            schedule_bulk(batch, size);
+        }
+        return TaskFuture<void>(group);
+    }
+
+    // Calls body(i) for every i in [begin, end) and returns when all calls
+    // have finished. The calling thread runs the range itself and splits off
+    // halves only while other workers are idle, so the number of tasks
+    // follows the load rather than a fixed grain. The first exception thrown
+    // by body is rethrown here; remaining iterations are skipped.
+    template<typename Index, typename Body>
+    void parallel_for(Index begin, Index end, Body&& body) {
+        static_assert(std::is_integral_v<Index>, "parallel_for needs an integral index");
+        if (!(begin < end)) {
+            return;
+        }
+
+        ForLoop<std::remove_reference_t<Body>> loop(body);
+        run_loop(loop, begin, end);
+    }
+
+    // Returns combine(...combine(identity, map(begin))..., map(end - 1)),
+    // split like parallel_for. Every thread that takes part folds into its
+    // own cache-line sized slot and the slots are combined pairwise at the
+    // end, so nothing is shared while the loop runs. combine must be
+    // associative and commutative, and identity its neutral element.
+    template<typename Index, typename T, typename Map, typename Combine>
+    T parallel_reduce(Index begin, Index end, T identity, Map&& map, Combine&& combine) {
+        static_assert(std::is_integral_v<Index>, "parallel_reduce needs an integral index");
+        if (!(begin < end)) {
+            return identity;
+        }
+
+        ReduceLoop<T, std::remove_reference_t<Map>, std::remove_reference_t<Combine>>
+            loop(identity, map, combine, worker_data.size());
+        run_loop(loop, begin, end);
+        return loop.join();
+    }
+
+    // Runs every callable, possibly in parallel, and returns when all have
+    // finished. All but the last are pushed to the caller's deque and the last
+    // runs inline; afterwards the caller pops back whatever no thief took, so
+    // an unstolen branch costs a push and a pop. Branch nodes live in this
+    // frame, no allocation is made. The first exception is rethrown here.
+    template<typename... Fs>
+    void parallel_invoke(Fs&&... fs) {
+        constexpr size_t spawned = sizeof...(Fs) - 1;
+        static_assert(sizeof...(Fs) >= 1, "parallel_invoke needs at least one callable");
+
+        auto branches = std::forward_as_tuple(fs...);
+        if constexpr (spawned == 0) {
+            std::get<0>(branches)();
+        } else {
+            LoopControl control;
+            control.latch.count_up(spawned - 1);
+            std::array<InvokeTask, spawned> tasks;
+            bind_branches(tasks.data(), control, branches, std::make_index_sequence<spawned>{});
+            for (auto& task : tasks) {
+                schedule(&task);
+            }
+
+            try {
+                std::get<spawned>(branches)();
+            } catch (...) {
+                control.fail(std::current_exception());
+            }
+
+            size_t id = current_worker_id();
+            if (id < worker_data.size()) {
+                auto& queue = worker_data[id]->local_queues[level_of(tasks[0].priority)];
+                for (size_t i = spawned; i-- > 0;) {
+                    Task* task = queue.pop();
+                    if (task == &tasks[i]) {
+                        run_task(task);
+                        continue;
+                    }
+                    // Stolen, and so are all older branches; put back what we took.
+                    if (task) {
+                        queue.push(task);
+                    }
+                    break;
+                }
+                run_tasks_until(control.latch);
+            } else {
+                control.latch.wait();
+            }
+
+            if (control.error) {
+                std::rethrow_exception(control.error);
+            }
+        }
+    }
+
+    // Fire-and-forget: schedules f(args...) without a result channel. An
+    // exception escaping it goes to the pool's exception handler.
+    template<typename F, typename... Args>
+    void post(F&& f, Args&&... args) {
+        schedule(make_posted_task(std::forward<F>(f), std::forward<Args>(args)...));
+    }
+
+    // Like enqueue(), but ordered earliest-deadline-first among deadline tasks,
+    // which workers take ahead of the priority levels. If the task has not
+    // started by the deadline it is dropped: f does not run and the future
+    // throws DeadlineExpiredError.
+    template<typename F, typename... Args>
+    auto enqueue_with_deadline(std::chrono::steady_clock::time_point deadline, F&& f, Args&&... args)
+        -> TaskFuture<typename std::invoke_result<F, Args...>::type> {
+        using return_type = typename std::invoke_result<F, Args...>::type;
+
+        auto expired = [deadline]() {
+            return std::chrono::steady_clock::now() > deadline ? std::make_exception_ptr(DeadlineExpiredError())
+                                                              : std::exception_ptr();
+        };
+        auto task = make_packaged_task(expired, std::forward<F>(f), std::forward<Args>(args)...);
+        FutureState<return_type>* state = task;
+        schedule_deadline(task, deadline);
+        return TaskFuture<return_type>(state);
+    }
+
+    // Like enqueue(), but if token is cancelled before the task starts, f
+    // does not run and the future throws TaskCancelledError. While f runs,
+    // CancellationToken::current() is token, so f can poll it and TaskGroups
+    // created inside f are cancelled along with it.
+    template<typename F, typename... Args>
+    auto enqueue_cancellable(CancellationToken token, F&& f, Args&&... args)
+        -> TaskFuture<typename std::invoke_result<F, Args...>::type> {
+        using return_type = typename std::invoke_result<F, Args...>::type;
+
+        auto cancelled = [token]() {
+            return token.is_cancelled() ? std::make_exception_ptr(TaskCancelledError()) : std::exception_ptr();
+        };
+        auto body = [token = std::move(token), func = std::forward<F>(f)](auto&&... a) mutable -> return_type {
+            CancellationToken::Scope scope(token);
+            return std::invoke(func, std::forward<decltype(a)>(a)...);
+        };
+        auto task = make_packaged_task(cancelled, std::move(body), std::forward<Args>(args)...);
+        FutureState<return_type>* state = task;
+        schedule(task);
+        return TaskFuture<return_type>(state);
+    }
+
+    // enqueue() and post() at an explicit level instead of the caller's. Tasks
+    // the submitted one creates inherit its level.
+    template<typename F, typename... Args>
+    auto enqueue_with_priority(TaskPriority priority, F&& f, Args&&... args) {
+        PriorityScope scope(priority);
+        return enqueue(std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template<typename F, typename... Args>
+    void post_with_priority(TaskPriority priority, F&& f, Args&&... args) {
+        PriorityScope scope(priority);
+        post(std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    // Installs the handler for exceptions thrown by post()ed tasks. Without
+    // one they are dropped, as with a discarded future.
+    void set_exception_handler(std::function<void(std::exception_ptr)> handler) {
+        std::atomic_store(&exception_handler,
+                          std::make_shared<const std::function<void(std::exception_ptr)>>(std::move(handler)));
+    }
+
+    void wait() {
+        while (pending_count.load(std::memory_order_acquire) > 0) {
+            uint32_t key = drained.prepare_wait();
+            if (pending_count.load(std::memory_order_acquire) == 0) {
+                drained.cancel_wait();
+                break;
+            }
+            drained.commit_wait(key);
+        }
+    }
+
+    size_t thread_count() const {
+        return threads.size();
+    }
+
+    // NUMA nodes the workers were spread over.
+    size_t numa_node_count() const {
+        return nodes.size();
+    }
+
+    size_t worker_numa_node(size_t worker) const {
+        return worker_data.at(worker)->node;
+    }
+
+    // CPU the worker is pinned to, or -1 without pinning (or if the OS
+    // refused it).
+    int worker_cpu(size_t worker) const {
+        return worker_data.at(worker)->cpu;
+    }
+
+    size_t pending_tasks() const {
+        return pending_count.load(std::memory_order_acquire);
+    }
+
+    // Task nodes obtained from the heap so far. Nodes are recycled through
+    // per-worker slabs, so this stops growing once the pool is warmed up.
+    size_t allocated_task_nodes() const {
+        size_t total = 0;
+        for (const auto& external : external_slabs) {
+            total += external.slab->reserved_blocks();
+        }
+        for (const auto& data : worker_data) {
+            total += data->task_slab->reserved_blocks();
+        }
+        return total;
+    }
+};
+
+template<typename R>
+template<typename F>
+auto TaskFuture<R>::then(F&& f) {
+    LockFreeThreadPool* pool = state->executor_pool();
+    if (!pool) {
+        throw std::future_error(std::future_errc::no_state);
+    }
+    return pool->chain(std::exchange(state, nullptr), std::forward<F>(f));
+}
+
+// Refers to a timer from post_after() or schedule_every(). Dropping the
+// handle leaves the timer running.
+class TimerHandle {
+private:
+    friend class LockFreeThreadPool;
+
+    LockFreeThreadPool::TimerNode* timer{nullptr};
+
+    explicit TimerHandle(LockFreeThreadPool::TimerNode* node) : timer(node) {}
+
+public:
+    TimerHandle() = default;
+
+    TimerHandle(TimerHandle&& other) noexcept : timer(std::exchange(other.timer, nullptr)) {}
+
+    TimerHandle& operator=(TimerHandle&& other) noexcept {
+        if (this != &other) {
+            if (timer) {
+                timer->release();
+            }
+            timer = std::exchange(other.timer, nullptr);
+        }
+        return *this;
+    }
+
+    ~TimerHandle() {
+        if (timer) {
+            timer->release();
+        }
+    }
+
+    // Stops the timer; a run already under way is not interrupted. Returns
+    // false if it had fired (one-shot), was cancelled or its pool is gone.
+    bool cancel() {
+        if (!timer || timer->done.exchange(true, std::memory_order_acq_rel)) {
+            return false;
+        }
+        timer->pool->cancel_timer(timer);
+        return true;
+    }
+
+    bool active() const {
+        return timer && !timer->done.load(std::memory_order_acquire);
+    }
+};
+
+template<typename Rep, typename Period, typename F>
+TimerHandle LockFreeThreadPool::post_after(std::chrono::duration<Rep, Period> delay, F&& f) {
+    TimerNode* timer = new_timer(tick_at(std::chrono::steady_clock::now() + delay), 2);
+    timer->payload = make_posted_task(std::forward<F>(f));
+    arm_timer(timer);
+    return TimerHandle(timer);
+}
+
+template<typename Rep, typename Period, typename F>
+TimerHandle LockFreeThreadPool::schedule_every(std::chrono::duration<Rep, Period> period, F&& f) {
+    auto ticks = std::chrono::ceil<std::chrono::milliseconds>(period) / TIMER_TICK;
+    TimerNode* timer = new_timer(tick_at(std::chrono::steady_clock::now() + period), 2);
+    timer->period = ticks > 0 ? static_cast<uint64_t>(ticks) : 1;
+    timer->callback = std::forward<F>(f);
+    arm_timer(timer);
+    return TimerHandle(timer);
+}
+
+// Structured group of fire-and-forget tasks on a pool. All tasks share one
+// outstanding counter and one exception slot; wait() returns once every task
+// run() so far has finished. wait() runs tasks inline instead of only
+// blocking: on a worker it runs queued tasks, so groups nest inside tasks;
+// elsewhere it runs the group's own tasks that run() from outside the pool
+// queued and no worker has started, and blocks once none are left. Other
+// work on the pool is never run there. Destroying a group cancels the tasks
+// that have not started yet and waits for the rest.
+//
+// The group's cancellation source derives from a parent token, by default
+// the one current where the group is created. A group made inside a task of
+// another group, or inside a cancellable task, is therefore cancelled along
+// with it.
+class TaskGroup {
+private:
+    static constexpr uint32_t WAITING = 1;
+    static constexpr uint32_t HELPER = 2;
+    static constexpr uint32_t ONE_TASK = 4;
+
+    LockFreeThreadPool& pool;
+    // Futex word: outstanding tasks times ONE_TASK, plus WAITING while a
+    // thread sleeps on it and HELPER while a worker waits in helper. The
+    // last task to finish wakes the sleepers and then no longer touches the
+    // group, which may already be gone; a waiter clears the bits.
+    std::atomic<uint32_t> state{0};
+    HelperSlot helper;
+    CancellationSource source;
+    const CancellationToken group_token{source.token()};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+
+    // A task run() from outside the pool. It is queued on the pool and also
+    // pushed onto the group's pending list, so that a wait() outside the
+    // pool can run it; whichever side sets claimed first runs the body. The
+    // queue and the list hold one reference each.
+    struct Member final : LockFreeThreadPool::Task {
+        std::atomic<bool> claimed{false};
+        std::atomic<uint32_t> refs{2};
+        Member* pending_next{nullptr};
+
+        Member() {
+            this->dispose = &dispose_member;
+        }
+
+        static void dispose_member(LockFreeThreadPool::Task* task) {
+            static_cast<Member*>(task)->release();
+        }
+
+        void release() {
+            if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                this->~Member();
+                TaskSlab::deallocate(this);
+            }
+        }
+    };
+
+    // Newest first; taken wholesale, so there is no ABA.
+    std::atomic<Member*> pending{nullptr};
+
+    template<typename F>
+    void execute(F& func) {
+        if (!group_token.is_cancelled()) {
+            CancellationToken::Scope scope(group_token);
+            try {
+                func();
+            } catch (...) {
+                if (!failed.exchange(true, std::memory_order_acq_rel)) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        finish_one();
+    }
+
+    // Runs, oldest first, the members of a list taken from pending that no
+    // worker has claimed yet, and drops the list's references.
+    static void run_pending(Member* list) {
+        Member* oldest = nullptr;
+        while (list) {
+            Member* next = list->pending_next;
+            list->pending_next = oldest;
+            oldest = list;
+            list = next;
+        }
+        while (oldest) {
+            Member* next = oldest->pending_next;
+            if (!oldest->claimed.load(std::memory_order_acquire)) {
+                LockFreeThreadPool::PriorityScope scope(oldest->priority);
+                oldest->func();
+            }
+            oldest->release();
+            oldest = next;
+        }
+    }
+
+    void finish_one() {
+        SharedEventCount* wake;
+        uint32_t previous = helper.update(state, HELPER, [](uint32_t value) { return value - ONE_TASK; }, wake);
+        bool last = previous < 2 * ONE_TASK;
+        if (last && (previous & WAITING)) {
+            Futex::wake(state, std::numeric_limits<int>::max());
+        }
+        HelperSlot::notify(wake, last);
+    }
+
+    bool done() const {
+        return state.load(std::memory_order_acquire) < ONE_TASK;
+    }
+
+    void drain() {
+        if (pool.current_worker_id() < pool.worker_data.size()) {
+            pool.run_tasks_until([this]() { return done(); },
+                                 [this](SharedEventCount& sleepers) { return helper.arm(state, HELPER, sleepers); });
+            state.fetch_and(~HELPER, std::memory_order_relaxed);
+            helper.reset();
+            return;
+        }
+
+        while (!done()) {
+            Member* list = pending.exchange(nullptr, std::memory_order_acquire);
+            if (!list) {
+                break;
+            }
+            run_pending(list);
+        }
+
+        uint32_t current = state.load(std::memory_order_acquire);
+        while (current >= ONE_TASK) {
+            if (!(current & WAITING) &&
+                !state.compare_exchange_weak(current, current | WAITING, std::memory_order_acquire)) {
+                continue;
+            }
+            Futex::wait(state, current | WAITING);
+            current = state.load(std::memory_order_acquire);
+        }
+        if (current != 0) {
+            state.compare_exchange_strong(current, 0, std::memory_order_relaxed);
+        }
+        // Workers ran whatever is left on the list; only the references remain.
+        run_pending(pending.exchange(nullptr, std::memory_order_acquire));
+    }
+
+public:
+    explicit TaskGroup(LockFreeThreadPool& p, const CancellationToken& parent = CancellationToken::current())
+        : pool(p), source(parent) {}
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    ~TaskGroup() {
+        cancel();
+        drain();
+    }
+
+    // Schedules f() as part of the group. Exceptions are kept for wait();
+    // after cancel() tasks that have not started are skipped.
+    template<typename F>
+    void run(F&& f) {
+        state.fetch_add(ONE_TASK, std::memory_order_relaxed);
+        if (pool.current_worker_id() < pool.worker_data.size()) {
+            auto task = pool.allocate_task<LockFreeThreadPool::Task>();
+            task->func = [this, func = std::forward<F>(f)]() mutable {
+                execute(func);
+            };
+            pool.schedule(task);
+            return;
+        }
+
+        auto task = pool.allocate_task<Member>();
+        task->func = [this, task, func = std::forward<F>(f)]() mutable {
+            if (!task->claimed.exchange(true, std::memory_order_acq_rel)) {
+                execute(func);
+            }
+        };
+        Member* head = pending.load(std::memory_order_relaxed);
+        do {
+            task->pending_next = head;
+        } while (!pending.compare_exchange_weak(head, task, std::memory_order_release, std::memory_order_relaxed));
+        pool.schedule(task);
+    }
+
+    // Runs tasks, then blocks, until all tasks have finished; then rethrows
+    // the first exception any of them threw.
+    void wait() {
+        drain();
+        if (failed.load(std::memory_order_acquire)) {
+            std::exception_ptr e = std::exchange(error, nullptr);
+            failed.store(false, std::memory_order_relaxed);
+            std::rethrow_exception(e);
+        }
+    }
+
+    // Also cancels groups and cancellable tasks derived from token().
+    void cancel() {
+        source.cancel();
+    }
+
+    bool is_cancelled() const {
+        return group_token.is_cancelled();
+    }
+
+    const CancellationToken& token() const {
+        return group_token;
+    }
+};
+
+// Reusable dependency graph. Nodes are callables, precede(a, b) makes b wait
+// for a. Every node embeds its pool task and an atomic count of unfinished
+// predecessors; whoever finishes the last predecessor schedules the node,
+// which lands on that worker's own deque. Once built, run() only resets the
+// counters, so repeated runs do not allocate. A graph runs on one pool at a
+// time.
+class TaskGraph {
+public:
+    using NodeId = size_t;
+
+private:
+    struct Node : LockFreeThreadPool::Task {
+        TaskGraph* graph{nullptr};
+        NodeId id{0};
+        TaskFunction<> body;
+        std::vector<Node*> successors;
+        size_t predecessors{0};
+        std::atomic<size_t> pending{0};
+    };
+
+    // Live only while run() is in progress; on its stack.
+    struct Run : LockFreeThreadPool::LoopControl {
+        LockFreeThreadPool* pool{nullptr};
+    };
+
+    std::deque<Node> nodes;
+    std::vector<LockFreeThreadPool::Task*> roots;
+    bool validated{false};
+    Run* active{nullptr};
+
+    void execute(Node* node) {
+        if (!active->failed.load(std::memory_order_relaxed)) {
+            try {
+                node->body();
+            } catch (...) {
+                active->fail(std::current_exception());
+            }
+        }
+        for (Node* next : node->successors) {
+            if (next->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                active->pool->schedule(next);
+            }
+        }
+    }
+
+    // Runs after the node's task is done with it; the run may end here.
+    static void dispose_node(LockFreeThreadPool::Task* task) {
+        static_cast<Node*>(task)->graph->active->latch.count_down();
+    }
+
+    // Kahn's algorithm over the predecessor counts; rebuilds the root list.
+    void validate() {
+        roots.clear();
+        std::vector<size_t> remaining(nodes.size());
+        std::vector<Node*> ready;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            remaining[i] = nodes[i].predecessors;
+            if (remaining[i] == 0) {
+                ready.push_back(&nodes[i]);
+                roots.push_back(&nodes[i]);
+            }
+        }
+
+        size_t visited = 0;
+        while (!ready.empty()) {
+            Node* node = ready.back();
+            ready.pop_back();
+            ++visited;
+            for (Node* next : node->successors) {
+                if (--remaining[next->id] == 0) {
+                    ready.push_back(next);
+                }
+            }
+        }
+        if (visited != nodes.size()) {
+            throw std::logic_error("TaskGraph contains a cycle");
+        }
+        validated = true;
+    }
+
+public:
+    TaskGraph() = default;
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    template<typename F>
+    NodeId add(F&& f) {
+        Node& node = nodes.emplace_back();
+        node.graph = this;
+        node.id = nodes.size() - 1;
+        node.body = std::forward<F>(f);
+        node.dispose = &dispose_node;
+        node.func = [node_ptr = &node]() { node_ptr->graph->execute(node_ptr); };
+        validated = false;
+        return node.id;
+    }
+
+    // `after` will not start before `before` has finished.
+    void precede(NodeId before, NodeId after) {
+        nodes.at(before).successors.push_back(&nodes.at(after));
+        ++nodes[after].predecessors;
+        validated = false;
+    }
+
+    size_t size() const {
+        return nodes.size();
+    }
+
+    // Runs every node once, respecting the edges, and returns when all have
+    // finished. After the first exception the remaining bodies are skipped;
+    // it is rethrown here. Throws std::logic_error if the graph has a cycle.
+    void run(LockFreeThreadPool& pool) {
+        if (nodes.empty()) {
+            return;
+        }
+        if (!validated) {
+            validate();
+        }
+
+        Run run;
+        run.pool = &pool;
+        run.latch.count_up(nodes.size() - 1);
+        for (Node& node : nodes) {
+            node.pending.store(node.predecessors, std::memory_order_relaxed);
+        }
+        active = &run;
+
+        pool.schedule_bulk(roots.data(), roots.size());
+        if (pool.current_worker_id() < pool.worker_data.size()) {
+            pool.run_tasks_until(run.latch);
+        } else {
+            run.latch.wait();
+        }
+        active = nullptr;
+
+        if (run.error) {
+            std::rethrow_exception(run.error);
+        }
+    }
+};
@@ -69,21 +69,18 @@ int main() {
 
     auto start_time = std::chrono::high_resolution_clock::now();
 
-    for (int y = 0; y < IMAGE_HEIGHT; ++y) {
-        pool.enqueue([&pixels, y]() {
-            for (int x = 0; x < IMAGE_WIDTH; ++x) {
-                double real = (x - IMAGE_WIDTH / 2.0) * 4.0 / IMAGE_WIDTH;
-                double imag = (y - IMAGE_HEIGHT / 2.0) * 4.0 / IMAGE_WIDTH;
-                std::complex<double> c(real, imag);
-
-                int iterations = calculate_mandelbrot_iterations(c);
-                pixels[y * IMAGE_WIDTH + x] = map_iterations_to_color(iterations);
-            }
-        });
-    }
-
-    std::cout << "All tasks have been submitted. Waiting for calculations to finish..." << std::endl;
-    pool.wait();
+    // parallel_for returns once every row is done; rows are split across
+    // workers as they become idle, so there is no chunk size to tune.
+    pool.parallel_for(0, IMAGE_HEIGHT, [&pixels](int y) {
+        for (int x = 0; x < IMAGE_WIDTH; ++x) {
+            double real = (x - IMAGE_WIDTH / 2.0) * 4.0 / IMAGE_WIDTH;
+            double imag = (y - IMAGE_HEIGHT / 2.0) * 4.0 / IMAGE_WIDTH;
+            std::complex<double> c(real, imag);
+
+            int iterations = calculate_mandelbrot_iterations(c);
+            pixels[y * IMAGE_WIDTH + x] = map_iterations_to_color(iterations);
+        }
+    });
 
     auto end_time = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double, std::milli> elapsed_ms = end_time - start_time;
@@ -7,6 +7,13 @@
 #include <iomanip>
 #include <cmath>
 #include <thread>
+#include <ctime>
+#include <functional>
+#include <fstream>
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 using namespace std::chrono;
 
@@ -101,7 +108,7 @@ void benchmark_simple_tasks() {
             counter = 0;
         },
         [&]() {
-            std::vector<std::future<void>> futures;
+            std::vector<TaskFuture<void>> futures;
             futures.reserve(task_count);
             
             for (int i = 0; i < task_count; ++i) {
@@ -123,6 +130,399 @@ void benchmark_simple_tasks() {
     );
 }
 
+void benchmark_post_vs_enqueue() {
+    LockFreeThreadPool* pool = nullptr;
+    std::atomic<int> counter{0};
+    constexpr int task_count = 100000;
+
+    auto setup = [&]() {
+        pool = new LockFreeThreadPool(std::thread::hardware_concurrency());
+        counter = 0;
+    };
+    auto teardown = [&]() {
+        delete pool;
+        pool = nullptr;
+    };
+
+    auto with_future = Benchmark::run_benchmark(
+        "Fire-and-forget: enqueue() (future discarded)",
+        setup,
+        [&]() {
+            for (int i = 0; i < task_count; ++i) {
+                pool->enqueue([&counter]() {
+                    counter.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+            pool->wait();
+        },
+        teardown,
+        10,
+        task_count
+    );
+
+    auto without_future = Benchmark::run_benchmark(
+        "Fire-and-forget: post()",
+        setup,
+        [&]() {
+            for (int i = 0; i < task_count; ++i) {
+                pool->post([&counter]() {
+                    counter.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+            pool->wait();
+        },
+        teardown,
+        10,
+        task_count
+    );
+
+    std::cout << "\npost() vs enqueue() throughput: " << std::fixed << std::setprecision(2)
+              << without_future.throughput / with_future.throughput << "x\n";
+}
+
+void benchmark_bulk_enqueue() {
+    LockFreeThreadPool* pool = nullptr;
+    std::atomic<int> counter{0};
+    constexpr int task_count = 100000;
+
+    auto setup = [&]() {
+        pool = new LockFreeThreadPool(std::thread::hardware_concurrency());
+        counter = 0;
+    };
+    auto teardown = [&]() {
+        delete pool;
+        pool = nullptr;
+    };
+
+    auto one_by_one = Benchmark::run_benchmark(
+        "Bulk submission: enqueue() loop",
+        setup,
+        [&]() {
+            for (int i = 0; i < task_count; ++i) {
+                pool->enqueue([&counter]() {
+                    counter.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+            pool->wait();
+        },
+        teardown,
+        10,
+        task_count
+    );
+
+    auto bulk = Benchmark::run_benchmark(
+        "Bulk submission: enqueue_n()",
+        setup,
+        [&]() {
+            pool->enqueue_n(task_count, [&counter](size_t) {
+                counter.fetch_add(1, std::memory_order_relaxed);
+            }).get();
+        },
+        teardown,
+        10,
+        task_count
+    );
+
+    std::cout << "\nenqueue_n() vs enqueue() loop throughput: " << std::fixed << std::setprecision(2)
+              << bulk.throughput / one_by_one.throughput << "x\n";
+}
+
+int mandelbrot_iterations(int x, int y, int width, int height, int max_iterations) {
+    double c_re = (x - width / 2.0) * 4.0 / width;
+    double c_im = (y - height / 2.0) * 4.0 / width;
+    double z_re = 0.0;
+    double z_im = 0.0;
+    int iterations = 0;
+    while (z_re * z_re + z_im * z_im <= 4.0 && iterations < max_iterations) {
+        double next_re = z_re * z_re - z_im * z_im + c_re;
+        z_im = 2.0 * z_re * z_im + c_im;
+        z_re = next_re;
+        ++iterations;
+    }
+    return iterations;
+}
+
+void benchmark_parallel_for_mandelbrot() {
+    static constexpr int width = 960;
+    static constexpr int height = 540;
+    static constexpr int max_iterations = 500;
+
+    LockFreeThreadPool* pool = nullptr;
+    std::vector<int> image(width * height);
+
+    auto setup = [&]() {
+        pool = new LockFreeThreadPool(std::thread::hardware_concurrency());
+        std::fill(image.begin(), image.end(), 0);
+    };
+    auto teardown = [&]() {
+        delete pool;
+        pool = nullptr;
+    };
+
+    auto per_row = Benchmark::run_benchmark(
+        "Mandelbrot: one task per row",
+        setup,
+        [&]() {
+            for (int y = 0; y < height; ++y) {
+                pool->post([&image, y]() {
+                    for (int x = 0; x < width; ++x) {
+                        image[y * width + x] = mandelbrot_iterations(x, y, width, height, max_iterations);
+                    }
+                });
+            }
+            pool->wait();
+        },
+        teardown,
+        10,
+        width * height
+    );
+
+    auto lazy = Benchmark::run_benchmark(
+        "Mandelbrot: parallel_for over rows",
+        setup,
+        [&]() {
+            pool->parallel_for(0, height, [&image](int y) {
+                for (int x = 0; x < width; ++x) {
+                    image[y * width + x] = mandelbrot_iterations(x, y, width, height, max_iterations);
+                }
+            });
+        },
+        teardown,
+        10,
+        width * height
+    );
+
+    std::cout << "\nparallel_for vs per-row tasks throughput: " << std::fixed << std::setprecision(2)
+              << lazy.throughput / per_row.throughput << "x\n";
+}
+
+void benchmark_parallel_reduce() {
+    LockFreeThreadPool* pool = nullptr;
+    constexpr long long count = 10'000'000;
+    long long result = 0;
+
+    auto setup = [&]() {
+        pool = new LockFreeThreadPool(std::thread::hardware_concurrency());
+        result = 0;
+    };
+    auto teardown = [&]() {
+        delete pool;
+        pool = nullptr;
+    };
+
+    auto shared = Benchmark::run_benchmark(
+        "Reduction: parallel_for into a shared atomic",
+        setup,
+        [&]() {
+            std::atomic<long long> total{0};
+            pool->parallel_for(0LL, count, [&total](long long i) {
+                total.fetch_add(i & 7, std::memory_order_relaxed);
+            });
+            result = total.load();
+        },
+        teardown,
+        10,
+        count
+    );
+
+    auto partials = Benchmark::run_benchmark(
+        "Reduction: parallel_reduce with per-worker partials",
+        setup,
+        [&]() {
+            result = pool->parallel_reduce(0LL, count, 0LL,
+                [](long long i) { return i & 7; },
+                [](long long a, long long b) { return a + b; });
+        },
+        teardown,
+        10,
+        count
+    );
+
+    std::cout << "\nparallel_reduce vs shared atomic throughput: " << std::fixed << std::setprecision(2)
+              << partials.throughput / shared.throughput << "x\n";
+}
+
+void benchmark_task_group() {
+    LockFreeThreadPool* pool = nullptr;
+    std::atomic<int> counter{0};
+    constexpr int task_count = 100000;
+
+    auto setup = [&]() {
+        pool = new LockFreeThreadPool(std::thread::hardware_concurrency());
+        counter = 0;
+    };
+    auto teardown = [&]() {
+        delete pool;
+        pool = nullptr;
+    };
+
+    auto with_futures = Benchmark::run_benchmark(
+        "Join: vector of futures",
+        setup,
+        [&]() {
+            std::vector<TaskFuture<void>> futures;
+            futures.reserve(task_count);
+            for (int i = 0; i < task_count; ++i) {
+                futures.push_back(pool->enqueue([&counter]() {
+                    counter.fetch_add(1, std::memory_order_relaxed);
+                }));
+            }
+            for (auto& f : futures) {
+                f.get();
+            }
+        },
+        teardown,
+        10,
+        task_count
+    );
+
+    auto with_group = Benchmark::run_benchmark(
+        "Join: TaskGroup",
+        setup,
+        [&]() {
+            TaskGroup group(*pool);
+            for (int i = 0; i < task_count; ++i) {
+                group.run([&counter]() {
+                    counter.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+            group.wait();
+        },
+        teardown,
+        10,
+        task_count
+    );
+
+    std::cout << "\nTaskGroup vs futures throughput: " << std::fixed << std::setprecision(2)
+              << with_group.throughput / with_futures.throughput << "x\n";
+}
+
+long long fib_enqueue(LockFreeThreadPool& pool, int n) {
+    if (n < 2) {
+        return n;
+    }
+    auto left = pool.enqueue(fib_enqueue, std::ref(pool), n - 1);
+    long long right = fib_enqueue(pool, n - 2);
+    return left.get() + right;
+}
+
+long long fib_invoke(LockFreeThreadPool& pool, int n) {
+    if (n < 2) {
+        return n;
+    }
+    long long left = 0;
+    long long right = 0;
+    pool.parallel_invoke([&]() { left = fib_invoke(pool, n - 1); },
+                         [&]() { right = fib_invoke(pool, n - 2); });
+    return left + right;
+}
+
+void benchmark_parallel_invoke() {
+    LockFreeThreadPool* pool = nullptr;
+    constexpr int n = 27;
+    constexpr size_t calls = 317810; // fib(28) - 1 inner nodes, one spawn each
+    long long result = 0;
+
+    auto setup = [&]() {
+        pool = new LockFreeThreadPool(std::thread::hardware_concurrency());
+        result = 0;
+    };
+    auto teardown = [&]() {
+        delete pool;
+        pool = nullptr;
+    };
+
+    auto futures = Benchmark::run_benchmark(
+        "Fork-join fib(27): enqueue + get",
+        setup,
+        [&]() { result = pool->enqueue(fib_enqueue, std::ref(*pool), n).get(); },
+        teardown,
+        5,
+        calls
+    );
+
+    auto invoke = Benchmark::run_benchmark(
+        "Fork-join fib(27): parallel_invoke",
+        setup,
+        [&]() { result = pool->enqueue(fib_invoke, std::ref(*pool), n).get(); },
+        teardown,
+        5,
+        calls
+    );
+
+    std::cout << "\nparallel_invoke vs enqueue + get throughput: " << std::fixed << std::setprecision(2)
+              << invoke.throughput / futures.throughput << "x\n";
+}
+
+void benchmark_task_graph() {
+    constexpr int width = 8;
+    constexpr int depth = 64;
+    constexpr int node_count = width * depth;
+
+    LockFreeThreadPool* pool = nullptr;
+    std::vector<uint64_t> values(node_count);
+
+    auto stage = [&values](int index) {
+        uint64_t acc = static_cast<uint64_t>(index);
+        for (int i = 0; i < 2000; ++i) {
+            acc = acc * 6364136223846793005ULL + 1442695040888963407ULL;
+        }
+        values[index] = acc;
+    };
+
+    auto setup = [&]() {
+        pool = new LockFreeThreadPool(std::thread::hardware_concurrency());
+    };
+    auto teardown = [&]() {
+        delete pool;
+        pool = nullptr;
+    };
+
+    auto with_futures = Benchmark::run_benchmark(
+        "Pipeline 8x64: futures with blocking get per stage",
+        setup,
+        [&]() {
+            for (int layer = 0; layer < depth; ++layer) {
+                std::vector<TaskFuture<void>> current;
+                for (int i = 0; i < width; ++i) {
+                    current.push_back(pool->enqueue(stage, layer * width + i));
+                }
+                for (auto& f : current) {
+                    f.get();
+                }
+            }
+        },
+        teardown,
+        10,
+        node_count
+    );
+
+    TaskGraph graph;
+    for (int layer = 0; layer < depth; ++layer) {
+        for (int i = 0; i < width; ++i) {
+            int index = layer * width + i;
+            graph.add([&stage, index]() { stage(index); });
+            if (layer > 0) {
+                for (int j = 0; j < width; ++j) {
+                    graph.precede((layer - 1) * width + j, index);
+                }
+            }
+        }
+    }
+
+    auto with_graph = Benchmark::run_benchmark(
+        "Pipeline 8x64: TaskGraph (built once)",
+        setup,
+        [&]() { graph.run(*pool); },
+        teardown,
+        10,
+        node_count
+    );
+
+    std::cout << "\nTaskGraph vs futures throughput: " << std::fixed << std::setprecision(2)
+              << with_graph.throughput / with_futures.throughput << "x\n";
+}
+
 void benchmark_computational_tasks() {
     LockFreeThreadPool* pool = nullptr;
     constexpr int task_count = 10000;
@@ -133,7 +533,7 @@ void benchmark_computational_tasks() {
             pool = new LockFreeThreadPool(std::thread::hardware_concurrency());
         },
         [&]() {
-            std::vector<std::future<double>> futures;
+            std::vector<TaskFuture<double>> futures;
             futures.reserve(task_count);
             
             for (int i = 0; i < task_count; ++i) {
@@ -170,7 +570,7 @@ void benchmark_io_simulation() {
             pool = new LockFreeThreadPool(std::thread::hardware_concurrency() * 2);
         },
         [&]() {
-            std::vector<std::future<void>> futures;
+            std::vector<TaskFuture<void>> futures;
             futures.reserve(task_count);
             
             for (int i = 0; i < task_count; ++i) {
@@ -202,7 +602,7 @@ void benchmark_mixed_workload() {
             pool = new LockFreeThreadPool(std::thread::hardware_concurrency());
         },
         [&]() {
-            std::vector<std::future<double>> futures;
+            std::vector<TaskFuture<double>> futures;
             futures.reserve(task_count);
             std::mt19937 rng(42);
             std::uniform_int_distribution<int> dist(0, 2);
@@ -248,52 +648,638 @@ void benchmark_mixed_workload() {
     );
 }
 
+void benchmark_task_callable() {
+    constexpr int task_count = 1000000;
+    std::atomic<int> counter{0};
+    auto promise = std::make_shared<std::promise<void>>();
+
+    // Same shape as the closure enqueue() builds: a shared result slot plus
+    // the user's captures.
+    auto make_closure = [&](int i) {
+        return [promise, &counter, i]() {
+            counter.fetch_add(i & 1, std::memory_order_relaxed);
+        };
+    };
+
+    Benchmark::run_benchmark(
+        "Task Callable: std::function<void()>",
+        []() {},
+        [&]() {
+            for (int i = 0; i < task_count; ++i) {
+                std::function<void()> f = make_closure(i);
+                std::function<void()> queued = std::move(f);
+                queued();
+            }
+        },
+        []() {},
+        5,
+        task_count
+    );
+
+    Benchmark::run_benchmark(
+        "Task Callable: TaskFunction<> (inline storage)",
+        []() {},
+        [&]() {
+            for (int i = 0; i < task_count; ++i) {
+                TaskFunction<> f = make_closure(i);
+                TaskFunction<> queued = std::move(f);
+                queued();
+            }
+        },
+        []() {},
+        5,
+        task_count
+    );
+}
+
+void benchmark_task_allocations() {
+    std::cout << "\n=== Task Node Allocations ===\n";
+    constexpr int warmup_rounds = 5;
+    constexpr int rounds = 50;
+    constexpr int task_count = 10000;
+
+    LockFreeThreadPool pool(std::thread::hardware_concurrency());
+    std::atomic<int> counter{0};
+
+    auto run_round = [&]() {
+        for (int i = 0; i < task_count; ++i) {
+            pool.enqueue([&counter]() {
+                counter.fetch_add(1, std::memory_order_relaxed);
+            });
+        }
+        pool.wait();
+    };
+
+    // The slabs only grow to the peak number of in-flight tasks, which is at
+    // most task_count per round; after warming up every node is recycled.
+    for (int r = 0; r < warmup_rounds; ++r) {
+        run_round();
+    }
+    size_t warm = pool.allocated_task_nodes();
+
+    auto start = high_resolution_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        run_round();
+    }
+    double elapsed = duration_cast<microseconds>(high_resolution_clock::now() - start).count() / 1000.0;
+    size_t steady = pool.allocated_task_nodes();
+
+    std::cout << "Task nodes from heap after warm-up:        " << warm << "\n";
+    std::cout << "Task nodes from heap after " << rounds << " more rounds: " << steady << "\n";
+    std::cout << "Steady-state heap allocations per task:    "
+              << std::fixed << std::setprecision(4)
+              << static_cast<double>(steady - warm) / (rounds * task_count) << "\n";
+    std::cout << "Throughput: " << std::setprecision(0)
+              << (rounds * task_count * 1000.0) / elapsed << " ops/sec\n";
+}
+
+void benchmark_external_producers() {
+    constexpr int producer_count = 4;
+    constexpr int tasks_per_producer = 25000;
+    constexpr int task_count = producer_count * tasks_per_producer;
+
+    LockFreeThreadPool* pool = nullptr;
+    std::vector<double> queue_delays_us(task_count);
+
+    Benchmark::run_benchmark(
+        "External Producers (global queue)",
+        [&]() {
+            pool = new LockFreeThreadPool(std::max(4u, std::thread::hardware_concurrency()));
+        },
+        [&]() {
+            std::vector<std::thread> producers;
+            for (int p = 0; p < producer_count; ++p) {
+                producers.emplace_back([&, p]() {
+                    for (int i = 0; i < tasks_per_producer; ++i) {
+                        auto submitted = high_resolution_clock::now();
+                        int index = p * tasks_per_producer + i;
+                        pool->enqueue([&queue_delays_us, submitted, index]() {
+                            queue_delays_us[index] =
+                                duration<double, std::micro>(high_resolution_clock::now() - submitted).count();
+                        });
+                    }
+                });
+            }
+            for (auto& t : producers) {
+                t.join();
+            }
+            pool->wait();
+        },
+        [&]() {
+            delete pool;
+            pool = nullptr;
+        },
+        10,
+        task_count
+    );
+
+    // Queueing delay of the last iteration. With a LIFO global queue the
+    // oldest submissions wait for everything behind them and the tail explodes.
+    std::vector<double> sorted = queue_delays_us;
+    std::sort(sorted.begin(), sorted.end());
+    std::cout << "  Queue delay (last iteration):\n";
+    std::cout << "    p50: " << std::fixed << std::setprecision(1) << sorted[task_count / 2] << " us\n";
+    std::cout << "    p99: " << sorted[task_count * 99 / 100] << " us\n";
+    std::cout << "    max: " << sorted.back() << " us\n";
+}
+
+void benchmark_priority_latency() {
+    std::cout << "\n=== High-Priority Latency Under Saturated Load ===\n";
+    constexpr int load_tasks = 5000;
+    constexpr int probes = 200;
+
+    // Background tasks at load_level, probes at probe_level submitted while
+    // the backlog is still queued. With from_worker the probes are spawned by
+    // a task that keeps its worker busy, so they sit in that worker's deque
+    // and only start when another worker steals them. Returns sorted probe
+    // start delays in us.
+    auto measure = [](TaskPriority load_level, TaskPriority probe_level, bool from_worker) {
+        LockFreeThreadPool pool(std::max(2u, std::thread::hardware_concurrency()));
+        auto spawn_probes = [&pool, probe_level, from_worker]() {
+            std::vector<TaskFuture<double>> delays;
+            delays.reserve(probes);
+            for (int i = 0; i < probes; ++i) {
+                auto submitted = high_resolution_clock::now();
+                delays.push_back(pool.enqueue_with_priority(probe_level, [submitted]() {
+                    return duration<double, std::micro>(high_resolution_clock::now() - submitted).count();
+                }));
+                if (from_worker) {
+                    auto until = high_resolution_clock::now() + microseconds(200);
+                    while (high_resolution_clock::now() < until) {
+                    }
+                } else {
+                    std::this_thread::sleep_for(microseconds(200));
+                }
+            }
+            return delays;
+        };
+
+        // Submitted before the load so that a worker picks it up at once.
+        TaskFuture<std::vector<TaskFuture<double>>> spawner;
+        if (from_worker) {
+            spawner = pool.enqueue_with_priority(load_level, spawn_probes);
+        }
+        for (int i = 0; i < load_tasks; ++i) {
+            pool.post_with_priority(load_level, []() {
+                auto until = high_resolution_clock::now() + microseconds(50);
+                while (high_resolution_clock::now() < until) {
+                }
+            });
+        }
+
+        std::vector<TaskFuture<double>> delays = from_worker ? spawner.get() : spawn_probes();
+        std::vector<double> sorted;
+        for (auto& delay : delays) {
+            sorted.push_back(delay.get());
+        }
+        pool.wait();
+        std::sort(sorted.begin(), sorted.end());
+        return sorted;
+    };
+
+    auto report = [](const char* name, const std::vector<double>& sorted) {
+        std::cout << name << ":\n";
+        std::cout << "  p50: " << std::fixed << std::setprecision(1) << sorted[sorted.size() / 2] << " us\n";
+        std::cout << "  p99: " << sorted[sorted.size() * 99 / 100] << " us\n";
+        std::cout << "  max: " << sorted.back() << " us\n";
+    };
+
+    report("Probes at Normal behind Normal load", measure(TaskPriority::Normal, TaskPriority::Normal, false));
+    report("Probes at High behind Low load", measure(TaskPriority::Low, TaskPriority::High, false));
+    report("Probes at High spawned by a busy worker", measure(TaskPriority::Low, TaskPriority::High, true));
+}
+
+void benchmark_deadline_overload() {
+    std::cout << "\n=== Deadline Tasks Under 2x Overload ===\n";
+    constexpr int task_count = 4000;
+    static constexpr auto work = microseconds(100);
+    static constexpr auto slack = milliseconds(5);
+
+    struct Outcome {
+        int on_time;
+        int stale;
+    };
+
+    // Submits tasks at twice the rate the pool can serve them; a task is only
+    // worth running if it starts within slack of its submission.
+    auto measure = [](bool use_deadlines) {
+        size_t workers = std::max(1u, std::thread::hardware_concurrency());
+        LockFreeThreadPool pool(workers);
+        auto interval = work / (2 * workers);
+        std::atomic<int> on_time{0};
+        std::atomic<int> stale{0};
+
+        auto start = steady_clock::now();
+        for (int i = 0; i < task_count; ++i) {
+            auto submitted = start + i * interval;
+            std::this_thread::sleep_until(submitted);
+            auto deadline = submitted + slack;
+            auto body = [&on_time, &stale, deadline]() {
+                auto now = steady_clock::now();
+                (now <= deadline ? on_time : stale)++;
+                auto until = now + work;
+                while (steady_clock::now() < until) {
+                }
+            };
+            if (use_deadlines) {
+                pool.enqueue_with_deadline(deadline, body);
+            } else {
+                pool.post(body);
+            }
+        }
+        pool.wait();
+        return Outcome{on_time.load(), stale.load()};
+    };
+
+    Outcome plain = measure(false);
+    Outcome edf = measure(true);
+    std::cout << "Out of " << task_count << " tasks (started in time / ran after deadline):\n";
+    std::cout << "  post:                  " << plain.on_time << " / " << plain.stale << "\n";
+    std::cout << "  enqueue_with_deadline: " << edf.on_time << " / " << edf.stale << "\n";
+}
+
+void benchmark_timers() {
+    constexpr int timer_count = 1000000;
+
+    LockFreeThreadPool pool(std::thread::hardware_concurrency());
+    std::vector<TimerHandle> handles(timer_count);
+
+    Benchmark::run_benchmark(
+        "Timer Wheel: 1M post_after + cancel",
+        []() {},
+        [&]() {
+            for (int i = 0; i < timer_count; ++i) {
+                // Spread over 1 s .. ~1 h so every wheel level is used.
+                auto delay = seconds(1) + milliseconds((i * 7919LL) % 3600000);
+                handles[i] = pool.post_after(delay, []() {});
+            }
+            for (auto& handle : handles) {
+                handle.cancel();
+            }
+        },
+        []() {},
+        5,
+        timer_count * 2
+    );
+
+    constexpr int samples = 500;
+    std::vector<TaskFuture<double>> lateness;
+    lateness.reserve(samples);
+    for (int i = 0; i < samples; ++i) {
+        auto due = steady_clock::now() + microseconds(1000 + (i * 7919) % 100000);
+        lateness.push_back(pool.enqueue_at(due, [due]() {
+            return duration<double, std::micro>(steady_clock::now() - due).count();
+        }));
+    }
+    std::vector<double> sorted;
+    for (auto& late : lateness) {
+        sorted.push_back(late.get());
+    }
+    std::sort(sorted.begin(), sorted.end());
+    std::cout << "  Firing lateness over " << samples << " timers (1 ms ticks):\n";
+    std::cout << "    p50: " << std::fixed << std::setprecision(1) << sorted[samples / 2] << " us\n";
+    std::cout << "    p99: " << sorted[samples * 99 / 100] << " us\n";
+    std::cout << "    max: " << sorted.back() << " us\n";
+}
+
+void benchmark_cancelled_shutdown() {
+    std::cout << "\n=== Shutdown With a Stale Backlog ===\n";
+    constexpr int backlog = 20000;
+
+    // Queues backlog 50us tasks, then destroys the pool right away,
+    // optionally cancelling them first. Returns the destructor's time in ms.
+    auto measure = [](bool cancel) {
+        auto pool = std::make_unique<LockFreeThreadPool>(std::thread::hardware_concurrency());
+        CancellationSource source;
+        for (int i = 0; i < backlog; ++i) {
+            pool->enqueue_cancellable(source.token(), []() {
+                auto until = high_resolution_clock::now() + microseconds(50);
+                while (high_resolution_clock::now() < until) {
+                }
+            });
+        }
+        auto start = high_resolution_clock::now();
+        if (cancel) {
+            source.cancel();
+        }
+        pool.reset();
+        return duration<double, std::milli>(high_resolution_clock::now() - start).count();
+    };
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Destroying the pool with " << backlog << " queued tasks:\n";
+    std::cout << "  run to completion: " << measure(false) << " ms\n";
+    std::cout << "  cancelled first:   " << measure(true) << " ms\n";
+}
+
+void benchmark_idle_wakeup() {
+    std::cout << "\n=== Idle Pool: Wake-up Latency and CPU ===\n";
+    constexpr int samples = 200;
+
+    LockFreeThreadPool pool(std::thread::hardware_concurrency());
+    std::vector<double> latencies_us;
+    latencies_us.reserve(samples);
+
+    for (int i = 0; i < samples; ++i) {
+        // Long enough for every worker to give up spinning and park.
+        std::this_thread::sleep_for(milliseconds(5));
+
+        auto submitted = high_resolution_clock::now();
+        auto started = pool.enqueue([]() {
+            return high_resolution_clock::now();
+        }).get();
+        latencies_us.push_back(duration<double, std::micro>(started - submitted).count());
+    }
+
+    std::sort(latencies_us.begin(), latencies_us.end());
+    std::cout << "Wake-up latency over " << samples << " samples:\n";
+    std::cout << "  p50: " << std::fixed << std::setprecision(1) << latencies_us[samples / 2] << " us\n";
+    std::cout << "  p99: " << latencies_us[samples * 99 / 100] << " us\n";
+    std::cout << "  max: " << latencies_us.back() << " us\n";
+
+    constexpr auto idle_period = seconds(1);
+    std::clock_t cpu_start = std::clock();
+    auto wall_start = steady_clock::now();
+    std::this_thread::sleep_for(idle_period);
+    std::clock_t cpu_end = std::clock();
+    double wall_ms = duration<double, std::milli>(steady_clock::now() - wall_start).count();
+    double cpu_ms = 1000.0 * static_cast<double>(cpu_end - cpu_start) / CLOCKS_PER_SEC;
+
+    std::cout << "CPU burned by " << pool.thread_count() << " idle workers over "
+              << std::setprecision(0) << wall_ms << " ms: "
+              << std::setprecision(2) << cpu_ms << " ms ("
+              << 100.0 * cpu_ms / wall_ms << "% of one core)\n";
+}
+
+void benchmark_deep_recursion() {
+    std::cout << "\n=== Deep Recursive Fan-out: Local Deque Overflow ===\n";
+    static constexpr int depth = 2000;
+    static constexpr int fanout = 16;
+    constexpr int runs = 5;
+
+    // Every level queues its children before recursing, so one worker's
+    // deque ends up holding depth * fanout tasks, far beyond its initial
+    // capacity.
+    auto measure = [](QueueOverflow mode) {
+        ThreadPoolOptions options;
+        options.local_queue_overflow = mode;
+        LockFreeThreadPool pool(options);
+        std::atomic<long> sum{0};
+
+        std::function<void(int)> descend = [&](int level) {
+            TaskGroup group(pool);
+            for (int i = 0; i < fanout; ++i) {
+                group.run([&sum, level, i]() {
+                    long x = level * fanout + i;
+                    for (int k = 0; k < 50; ++k) {
+                        x = (x * 31 + k) % 1000003;
+                    }
+                    sum.fetch_add(x, std::memory_order_relaxed);
+                });
+            }
+            if (level > 0) {
+                descend(level - 1);
+            }
+            group.wait();
+        };
+
+        std::vector<double> times;
+        for (int run = 0; run < runs; ++run) {
+            auto start = high_resolution_clock::now();
+            pool.enqueue(descend, depth).get();
+            times.push_back(duration<double, std::milli>(high_resolution_clock::now() - start).count());
+        }
+        std::sort(times.begin(), times.end());
+        return times[runs / 2];
+    };
+
+    std::cout << depth << " levels x " << fanout << " children (" << depth * fanout
+              << " tasks queued at the deepest point), median of " << runs << ":\n";
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "  spill to global queue: " << measure(QueueOverflow::Spill) << " ms\n";
+    std::cout << "  grow local deque:      " << measure(QueueOverflow::Grow) << " ms\n";
+    std::cout << "  run overflow inline:   " << measure(QueueOverflow::RunInline) << " ms\n";
+}
+
+void benchmark_single_source() {
+    std::cout << "\n=== All Work Spawned by One Worker ===\n";
+    static constexpr int task_count = 200000;
+    constexpr int runs = 5;
+    size_t workers = std::max(4u, std::thread::hardware_concurrency());
+
+    LockFreeThreadPool pool(workers);
+    static std::atomic<int> next_slot{0};
+    std::vector<std::atomic<int>> ran(workers + 1);
+
+    std::vector<double> times;
+    for (int run = 0; run < runs; ++run) {
+        for (auto& count : ran) {
+            count = 0;
+        }
+        auto start = high_resolution_clock::now();
+        // One task queues everything on its own deque; the other workers
+        // only get work by stealing it.
+        pool.enqueue([&pool, &ran, workers]() {
+            for (int i = 0; i < task_count; ++i) {
+                pool.post([&ran, workers, i]() {
+                    static thread_local int slot = next_slot++;
+                    ran[std::min<size_t>(static_cast<size_t>(slot), workers)].fetch_add(1, std::memory_order_relaxed);
+                    volatile int x = i;
+                    for (int k = 0; k < 200; ++k) {
+                        x = x * 7 + k;
+                    }
+                });
+            }
+        }).get();
+        pool.wait();
+        times.push_back(duration<double, std::milli>(high_resolution_clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+
+    int busiest = 0;
+    int helpers = 0;
+    for (auto& count : ran) {
+        busiest = std::max(busiest, count.load());
+        helpers += count.load() > 0 ? 1 : 0;
+    }
+    std::cout << task_count << " tasks posted from one worker, " << workers << " workers, median of "
+              << runs << ": " << std::fixed << std::setprecision(2) << times[runs / 2] << " ms\n";
+    std::cout << "Last run: " << helpers << " workers ran tasks, the busiest ran "
+              << std::setprecision(1) << 100.0 * busiest / task_count << "%\n";
+
+    // The same redistribution on bare deques: the owner pops while thieves
+    // refill their own deques with steal_half. A batch still claims every
+    // task with its own CAS on the victim's top; it is not one operation.
+    std::vector<int> items(task_count);
+    WorkStealingDeque<int> victim(task_count);
+    for (auto& item : items) {
+        victim.push(&item);
+    }
+    static constexpr auto run = [](int* item) {
+        volatile int x = *item;
+        for (int k = 0; k < 200; ++k) {
+            x = x * 7 + k;
+        }
+    };
+    std::atomic<size_t> redistributed{0};
+    std::atomic<size_t> cas_rounds{0};
+    std::atomic<size_t> ready{0};
+    std::vector<std::thread> thieves;
+    for (size_t t = 1; t < workers; ++t) {
+        thieves.emplace_back([&victim, &redistributed, &cas_rounds, &ready]() {
+            WorkStealingDeque<int> own(4096);
+            size_t claimed = 0;
+            size_t rounds = 0;
+            ++ready;
+            while (true) {
+                if (int* item = own.pop()) {
+                    run(item);
+                    continue;
+                }
+                int* first = victim.steal_half(own, &rounds);
+                if (!first) {
+                    break;
+                }
+                claimed += 1 + own.size();
+                run(first);
+            }
+            redistributed += claimed;
+            cas_rounds += rounds;
+        });
+    }
+    while (ready.load() < thieves.size()) {
+        std::this_thread::yield();
+    }
+    while (int* item = victim.pop()) {
+        run(item);
+    }
+    for (auto& thief : thieves) {
+        thief.join();
+    }
+    std::cout << "Bare deques: " << redistributed.load() << " tasks moved by steal_half, "
+              << std::setprecision(2) << static_cast<double>(cas_rounds.load()) / std::max<size_t>(redistributed.load(), 1)
+              << " CAS round trips per moved task (one CAS each, not one per batch)\n";
+}
+
+void benchmark_memory_footprint() {
+    std::cout << "\n=== Pool Memory Footprint ===\n";
+
+#if defined(__linux__)
+    // Resident set size of this process in KB.
+    auto rss_kb = []() {
+        std::ifstream statm("/proc/self/statm");
+        long pages = 0;
+        long resident = 0;
+        statm >> pages >> resident;
+        return resident * sysconf(_SC_PAGESIZE) / 1024;
+    };
+
+    // Each pool is built in a forked child, so memory the allocator keeps
+    // after an earlier pool does not hide the next one's cost.
+    auto measure = [&rss_kb](size_t threads) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            return -1L;
+        }
+        pid_t child = fork();
+        if (child == 0) {
+            long before = rss_kb();
+            long grown;
+            {
+                LockFreeThreadPool pool(threads);
+                pool.enqueue([]() {}).get();
+                grown = rss_kb() - before;
+            }
+            ssize_t written = write(fds[1], &grown, sizeof(grown));
+            _exit(written == sizeof(grown) ? 0 : 1);
+        }
+        close(fds[1]);
+        long grown = -1;
+        if (child < 0 || read(fds[0], &grown, sizeof(grown)) != sizeof(grown)) {
+            grown = -1;
+        }
+        close(fds[0]);
+        if (child > 0) {
+            waitpid(child, nullptr, 0);
+        }
+        return grown;
+    };
+
+    std::cout << "Resident memory added by the pool (deques, slabs, stacks):\n";
+    long single = measure(1);
+    std::cout << "Threads:   1 | RSS: " << std::setw(7) << single << " KB\n";
+    for (size_t threads : {2, 4, 8, 16, 32, 64}) {
+        long kb = measure(threads);
+        std::cout << "Threads: " << std::setw(3) << threads
+                  << " | RSS: " << std::setw(7) << kb << " KB"
+                  << " | per extra worker: " << std::fixed << std::setprecision(1) << std::setw(6)
+                  << static_cast<double>(kb - single) / (threads - 1) << " KB\n";
+    }
+#else
+    // Reads /proc/self/statm and forks a child per pool size.
+    std::cout << "skipped: needs /proc and fork(), Linux only\n";
+#endif
+}
+
 void benchmark_scalability() {
     std::cout << "\n\n=== SCALABILITY TEST ===\n";
     constexpr int task_count = 100000;
     std::atomic<int> counter{0};
     
     std::vector<int> thread_counts = {1, 2, 4, 8, 16, 32};
-    std::vector<double> throughputs;
+    const std::vector<std::pair<ThreadPlacement, const char*>> policies = {
+        {ThreadPlacement::None, "none"},
+        {ThreadPlacement::Compact, "compact"},
+        {ThreadPlacement::Scatter, "scatter"},
+        {ThreadPlacement::PhysicalCores, "physical cores"},
+    };
     
-    for (int threads : thread_counts) {
-        if (threads > static_cast<int>(std::thread::hardware_concurrency() * 2)) {
-            break;
-        }
-        
-        LockFreeThreadPool pool(threads);
-        counter = 0;
-        
-        auto start = high_resolution_clock::now();
+    for (const auto& [policy, name] : policies) {
+        std::cout << "\nPlacement: " << name << "\n";
+        std::vector<double> throughputs;
         
-        std::vector<std::future<void>> futures;
-        for (int i = 0; i < task_count; ++i) {
-            futures.push_back(pool.enqueue([&counter]() {
-                counter.fetch_add(1, std::memory_order_relaxed);
-            }));
+        for (int threads : thread_counts) {
+            if (threads > static_cast<int>(std::thread::hardware_concurrency() * 2)) {
+                break;
+            }
+            
+            ThreadPoolOptions options;
+            options.num_threads = threads;
+            options.placement = policy;
+            LockFreeThreadPool pool(options);
+            counter = 0;
+            
+            auto start = high_resolution_clock::now();
+            
+            std::vector<TaskFuture<void>> futures;
+            for (int i = 0; i < task_count; ++i) {
+                futures.push_back(pool.enqueue([&counter]() {
+                    counter.fetch_add(1, std::memory_order_relaxed);
+                }));
+            }
+            
+            for (auto& f : futures) {
+                f.get();
+            }
+            
+            auto end = high_resolution_clock::now();
+            double elapsed = duration_cast<microseconds>(end - start).count() / 1000.0;
+            double throughput = (task_count * 1000.0) / elapsed;
+            
+            throughputs.push_back(throughput);
+            
+            std::cout << "Threads: " << std::setw(3) << threads 
+                     << " | Time: " << std::fixed << std::setprecision(2) << std::setw(8) << elapsed << " ms"
+                     << " | Throughput: " << std::fixed << std::setprecision(0) << std::setw(10) 
+                     << throughput << " ops/sec\n";
         }
         
-        for (auto& f : futures) {
-            f.get();
+        std::cout << "Speedup factors:";
+        for (size_t i = 1; i < throughputs.size(); ++i) {
+            std::cout << " " << thread_counts[i] << " threads: " 
+                     << std::fixed << std::setprecision(2) << throughputs[i] / throughputs[0] << "x";
         }
-        
-        auto end = high_resolution_clock::now();
-        double elapsed = duration_cast<microseconds>(end - start).count() / 1000.0;
-        double throughput = (task_count * 1000.0) / elapsed;
-        
-        throughputs.push_back(throughput);
-        
-        std::cout << "Threads: " << std::setw(3) << threads 
-                 << " | Time: " << std::fixed << std::setprecision(2) << std::setw(8) << elapsed << " ms"
-                 << " | Throughput: " << std::fixed << std::setprecision(0) << std::setw(10) 
-                 << throughput << " ops/sec\n";
-    }
-    
-    std::cout << "\nSpeedup factors:\n";
-    for (size_t i = 1; i < throughputs.size(); ++i) {
-        double speedup = throughputs[i] / throughputs[0];
-        std::cout << thread_counts[i] << " threads: " 
-                 << std::fixed << std::setprecision(2) << speedup << "x\n";
+        std::cout << "\n";
     }
 }
 
@@ -302,9 +1288,27 @@ int main() {
     std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << "\n";
     
     benchmark_simple_tasks();
+    benchmark_task_callable();
+    benchmark_task_allocations();
+    benchmark_post_vs_enqueue();
+    benchmark_bulk_enqueue();
+    benchmark_parallel_for_mandelbrot();
+    benchmark_parallel_reduce();
+    benchmark_task_group();
+    benchmark_parallel_invoke();
+    benchmark_task_graph();
     benchmark_computational_tasks();
     benchmark_io_simulation();
     benchmark_mixed_workload();
+    benchmark_external_producers();
+    benchmark_priority_latency();
+    benchmark_deadline_overload();
+    benchmark_timers();
+    benchmark_cancelled_shutdown();
+    benchmark_idle_wakeup();
+    benchmark_deep_recursion();
+    benchmark_single_source();
+    benchmark_memory_footprint();
     benchmark_scalability();
     
     std::cout << "\n=== BENCHMARK COMPLETE ===\n";
@@ -62,7 +62,7 @@ int main() {
 
         auto start_time = std::chrono::high_resolution_clock::now();
 
-        std::vector<std::future<std::unique_ptr<Matrix>>> futures;
+        std::vector<TaskFuture<std::unique_ptr<Matrix>>> futures;
         futures.reserve(num_tasks);
         for (int i = 0; i < num_tasks; ++i) {
             futures.emplace_back(pool.enqueue(perform_matrix_multiplication, std::cref(matrix_a), std::cref(matrix_b)));
@@ -86,7 +86,7 @@ int main() {
 
         auto start_time = std::chrono::high_resolution_clock::now();
 
-        std::vector<std::future<void>> futures;
+        std::vector<TaskFuture<void>> futures;
         futures.reserve(num_tasks);
         for (int i = 0; i < num_tasks; ++i) {
             if (dist(rng) == 0) {
@@ -107,36 +107,12 @@ int main() {
     {
         std::cout << "\n--- SCENARIO 3: Recursive Task Decomposition ---" << std::endl;
         const long long total_sum_up_to = 10'000'000;
-        const long long base_case_threshold = 10000;
 
         auto start_time = std::chrono::high_resolution_clock::now();
 
-        std::vector<std::future<long long>> futures;
-
-        std::function<void(long long, long long)> decompose_task =
-            [&](long long start, long long end) {
-
-            if (end - start <= base_case_threshold) {
-                futures.push_back(pool.enqueue([start, end]() {
-                    long long total = 0;
-                    for (long long i = start; i <= end; ++i) {
-                        total += i;
-                    }
-                    return total;
-                }));
-            } else {
-                long long mid = start + (end - start) / 2;
-                decompose_task(start, mid);
-                decompose_task(mid + 1, end);
-            }
-        };
-
-        decompose_task(1, total_sum_up_to);
-
-        long long final_result = 0;
-        for (auto& f : futures) {
-            final_result += f.get();
-        }
+        // Each level waits on its children from inside a worker; get() keeps
+        // the worker busy with queued tasks instead of blocking it.
+        long long final_result = pool.enqueue(recursive_sum, std::ref(pool), 1LL, total_sum_up_to).get();
 
         auto end_time = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double, std::milli> elapsed_ms = end_time - start_time;
@@ -8,6 +8,14 @@
 #include <algorithm>
 #include <numeric>
 #include <memory>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <array>
+#include <string>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std::chrono_literals;
 
@@ -36,7 +44,7 @@ TEST_F(ThreadPoolTest, MultipleTasksExecution) {
     LockFreeThreadPool pool(4);
     constexpr int task_count = 1000;
     
-    std::vector<std::future<int>> futures;
+    std::vector<TaskFuture<int>> futures;
     futures.reserve(task_count);
     
     for (int i = 0; i < task_count; ++i) {
@@ -135,7 +143,7 @@ TEST_F(ThreadPoolTest, StressTest) {
     constexpr int task_count = 100000;
     
     std::atomic<int> sum{0};
-    std::vector<std::future<void>> futures;
+    std::vector<TaskFuture<void>> futures;
     futures.reserve(task_count);
     
     auto start = std::chrono::high_resolution_clock::now();
@@ -245,7 +253,7 @@ TEST_F(ThreadPoolTest, LongRunningTasks) {
     std::atomic<int> concurrent_tasks{0};
     std::atomic<int> max_concurrent{0};
     
-    std::vector<std::future<void>> futures;
+    std::vector<TaskFuture<void>> futures;
     
     for (int i = 0; i < task_count; ++i) {
         futures.push_back(pool.enqueue([&]() {
@@ -332,7 +340,7 @@ TEST_F(ThreadPoolTest, PerformanceComparison) {
 
     auto lock_free_time = measure_time([&]() {
         LockFreeThreadPool pool(thread_count);
-        std::vector<std::future<void>> futures;
+        std::vector<TaskFuture<void>> futures;
 
         for (int i = 0; i < task_count; ++i) {
             futures.push_back(pool.enqueue([&counter]() {
@@ -357,7 +365,7 @@ TEST_F(ThreadPoolTest, BurstLoadTest) {
     constexpr int burst_count = 10;
     
     for (int burst = 0; burst < burst_count; ++burst) {
-        std::vector<std::future<void>> futures;
+        std::vector<TaskFuture<void>> futures;
         
         auto start = std::chrono::high_resolution_clock::now();
         
@@ -419,6 +427,2118 @@ TEST(TargetedThreadPoolTest, RingBufferContentionTest) {
     EXPECT_EQ(task_counter.load(), TOTAL_TASKS);
 }
 
+TEST_F(ThreadPoolTest, TaskNodesAreRecycledInSteadyState) {
+    LockFreeThreadPool pool(4);
+    constexpr int rounds = 50;
+    constexpr int tasks_per_round = 200;
+
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < tasks_per_round; ++i) {
+            pool.enqueue([this]() {
+                executed_count.fetch_add(1);
+            });
+        }
+        pool.wait();
+    }
+
+    // At most one round is ever in flight, so the slabs never need more
+    // nodes than that, however many tasks went through them.
+    size_t chunk = TaskSlab::BLOCKS_PER_CHUNK;
+    size_t bound = (tasks_per_round + chunk - 1) / chunk * chunk;
+    EXPECT_GT(pool.allocated_task_nodes(), 0u);
+    EXPECT_LE(pool.allocated_task_nodes(), bound);
+    EXPECT_EQ(executed_count.load(), rounds * tasks_per_round);
+}
+
+TEST_F(ThreadPoolTest, ConcurrentExternalProducers) {
+    LockFreeThreadPool pool(2);
+    constexpr int producers = 12;
+    constexpr int tasks_per_producer = 2000;
+
+    // More producers than external slabs, so some submissions take the
+    // heap fallback; every node must still come back.
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([this, &pool]() {
+            for (int i = 0; i < tasks_per_producer; ++i) {
+                pool.enqueue([this]() {
+                    executed_count.fetch_add(1);
+                });
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    pool.wait();
+
+    EXPECT_GT(pool.allocated_task_nodes(), 0u);
+    EXPECT_EQ(executed_count.load(), producers * tasks_per_producer);
+}
+
+TEST(TaskSlabTest, RemoteFreesAreReusedByOwner) {
+    auto* owner = new TaskSlab;
+    TaskSlab::thread_slab() = owner;
+
+    std::vector<void*> blocks;
+    for (size_t i = 0; i < TaskSlab::BLOCKS_PER_CHUNK; ++i) {
+        blocks.push_back(owner->allocate(64));
+    }
+    EXPECT_EQ(owner->reserved_blocks(), TaskSlab::BLOCKS_PER_CHUNK);
+
+    std::thread remote([&blocks]() {
+        for (void* block : blocks) {
+            TaskSlab::deallocate(block);
+        }
+    });
+    remote.join();
+
+    blocks.clear();
+    for (size_t i = 0; i < TaskSlab::BLOCKS_PER_CHUNK; ++i) {
+        blocks.push_back(owner->allocate(64));
+    }
+    EXPECT_EQ(owner->reserved_blocks(), TaskSlab::BLOCKS_PER_CHUNK);
+
+    void* large = owner->allocate(TaskSlab::PAYLOAD_SIZE + 1);
+    EXPECT_EQ(owner->reserved_blocks(), TaskSlab::BLOCKS_PER_CHUNK);
+    TaskSlab::deallocate(large);
+
+    for (void* block : blocks) {
+        TaskSlab::deallocate(block);
+    }
+    TaskSlab::thread_slab() = nullptr;
+    TaskSlab::retire(owner);
+}
+
+TEST(TaskSlabTest, RetiredSlabWaitsForOutstandingBlocks) {
+    auto* slab = new TaskSlab;
+    void* a = slab->allocate(32);
+    void* b = slab->allocate(32);
+
+    TaskSlab::retire(slab);
+
+    // Blocks handed out before retirement stay valid until they come back.
+    std::memset(a, 0xab, 32);
+    TaskSlab::deallocate(a);
+    std::memset(b, 0xcd, 32);
+    TaskSlab::deallocate(b);
+}
+
+TEST(TaskFutureTest, FutureOutlivesPool) {
+    TaskFuture<std::string> future;
+    {
+        LockFreeThreadPool pool(2);
+        future = pool.enqueue([]() {
+            return std::string(100, 'x');
+        });
+    }
+    EXPECT_EQ(future.get(), std::string(100, 'x'));
+    EXPECT_FALSE(future.valid());
+}
+
+TEST(TaskFutureTest, ReferenceAndLargeResults) {
+    LockFreeThreadPool pool(2);
+    int target = 0;
+    std::array<char, 1024> big{};
+    big[1023] = 7;
+
+    auto ref = pool.enqueue([&target]() -> int& { return target; });
+    auto large = pool.enqueue([big]() { return big; });
+
+    ref.get() = 5;
+    EXPECT_EQ(target, 5);
+    EXPECT_EQ(large.get()[1023], 7);
+}
+
+TEST(TaskFutureTest, WaitBlocksUntilSlowTaskCompletes) {
+    LockFreeThreadPool pool(2);
+    std::atomic<bool> release{false};
+    auto future = pool.enqueue([&release]() {
+        while (!release.load()) {
+            std::this_thread::sleep_for(1ms);
+        }
+        return 3;
+    });
+
+    EXPECT_FALSE(future.is_ready());
+    std::thread waiter([&future]() { future.wait(); });
+    std::this_thread::sleep_for(10ms);
+    release.store(true);
+    waiter.join();
+
+    EXPECT_TRUE(future.is_ready());
+    EXPECT_EQ(future.get(), 3);
+}
+
+TEST_F(ThreadPoolTest, PostRunsWithoutFuture) {
+    LockFreeThreadPool pool(4);
+    constexpr int task_count = 1000;
+
+    for (int i = 0; i < task_count; ++i) {
+        pool.post([this](int amount) {
+            executed_count.fetch_add(amount);
+        }, 1);
+    }
+    pool.wait();
+
+    EXPECT_EQ(executed_count.load(), task_count);
+    EXPECT_EQ(pool.pending_tasks(), 0u);
+}
+
+TEST_F(ThreadPoolTest, PostExceptionsReachPoolHandler) {
+    LockFreeThreadPool pool(2);
+    std::atomic<int> handled{0};
+    pool.set_exception_handler([&handled](std::exception_ptr error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (const std::runtime_error& e) {
+            if (std::string(e.what()) == "posted") {
+                handled.fetch_add(1);
+            }
+        }
+    });
+
+    for (int i = 0; i < 10; ++i) {
+        pool.post([]() { throw std::runtime_error("posted"); });
+    }
+    pool.post([this]() { executed_count.fetch_add(1); });
+    pool.wait();
+
+    EXPECT_EQ(handled.load(), 10);
+    EXPECT_EQ(executed_count.load(), 1);
+}
+
+TEST_F(ThreadPoolTest, MoveOnlyCapturesAndArguments) {
+    LockFreeThreadPool pool(2);
+
+    auto captured = pool.enqueue([value = std::make_unique<int>(21)]() {
+        return *value * 2;
+    });
+    auto argument = pool.enqueue([](std::unique_ptr<int> value) {
+        return *value + 1;
+    }, std::make_unique<int>(41));
+
+    EXPECT_EQ(captured.get(), 42);
+    EXPECT_EQ(argument.get(), 42);
+}
+
+TEST(TaskFunctionTest, InlineAndHeapStorage) {
+    struct Large {
+        char bytes[256];
+    };
+
+    int calls = 0;
+    auto small = [&calls]() { ++calls; };
+    auto large = [&calls, payload = Large{}]() { calls += 1 + payload.bytes[0]; };
+
+    EXPECT_EQ(sizeof(TaskFunction<>), 64u);
+    EXPECT_TRUE(TaskFunction<>::stores_inline<decltype(small)>());
+    EXPECT_FALSE(TaskFunction<>::stores_inline<decltype(large)>());
+    EXPECT_TRUE(TaskFunction<512>::stores_inline<decltype(large)>());
+
+    TaskFunction<> a(small);
+    TaskFunction<> b(large);
+    a();
+    b();
+    EXPECT_EQ(calls, 2);
+
+    TaskFunction<> moved(std::move(b));
+    EXPECT_FALSE(static_cast<bool>(b));
+    moved();
+    EXPECT_EQ(calls, 3);
+
+    moved = std::move(a);
+    moved();
+    EXPECT_EQ(calls, 4);
+}
+
+TEST(TaskFunctionTest, DestroysCapturesExactlyOnce) {
+    auto tracker = std::make_shared<int>(0);
+    {
+        TaskFunction<> f([tracker]() {});
+        EXPECT_EQ(tracker.use_count(), 2);
+        TaskFunction<> g(std::move(f));
+        EXPECT_EQ(tracker.use_count(), 2);
+        g.reset();
+        EXPECT_EQ(tracker.use_count(), 1);
+    }
+    EXPECT_EQ(tracker.use_count(), 1);
+}
+
+TEST(WorkStealingDequeTest, OwnerLifoThiefFifo) {
+    WorkStealingDeque<int> deque(8);
+    int values[4] = {0, 1, 2, 3};
+
+    for (int& v : values) {
+        EXPECT_TRUE(deque.push(&v));
+    }
+    EXPECT_EQ(deque.size(), 4u);
+
+    EXPECT_EQ(deque.pop(), &values[3]);
+    EXPECT_EQ(deque.steal(), &values[0]);
+    EXPECT_EQ(deque.pop(), &values[2]);
+    EXPECT_EQ(deque.steal(), &values[1]);
+    EXPECT_EQ(deque.pop(), nullptr);
+    EXPECT_EQ(deque.steal(), nullptr);
+    EXPECT_TRUE(deque.empty());
+}
+
+TEST(WorkStealingDequeTest, RejectsPushWhenFull) {
+    WorkStealingDeque<int> deque(4);
+    int values[5] = {};
+
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(deque.push(&values[i]));
+    }
+    EXPECT_FALSE(deque.push(&values[4]));
+
+    EXPECT_EQ(deque.steal(), &values[0]);
+    EXPECT_TRUE(deque.push(&values[4]));
+}
+
+TEST(WorkStealingDequeTest, PushBulkStopsAtCapacity) {
+    WorkStealingDeque<int> deque(8);
+    int values[10] = {};
+    int* items[10];
+    for (int i = 0; i < 10; ++i) {
+        items[i] = &values[i];
+    }
+
+    EXPECT_EQ(deque.push_bulk(items, 3), 3u);
+    EXPECT_EQ(deque.push_bulk(items + 3, 7), 5u);
+    EXPECT_EQ(deque.size(), 8u);
+
+    EXPECT_EQ(deque.steal(), &values[0]);
+    EXPECT_EQ(deque.pop(), &values[7]);
+}
+
+TEST(WorkStealingDequeTest, CapacityIsRoundedUpAtRuntime) {
+    WorkStealingDeque<int> deque(5);
+    EXPECT_EQ(deque.capacity(), 8u);
+    EXPECT_EQ(WorkStealingDeque<int>(1).capacity(), 1u);
+    EXPECT_EQ(WorkStealingDeque<int>().capacity(), 4096u);
+
+    int values[9] = {};
+    for (int i = 0; i < 8; ++i) {
+        EXPECT_EQ(deque.room(), 8u - i);
+        EXPECT_TRUE(deque.push(&values[i]));
+    }
+    EXPECT_EQ(deque.room(), 0u);
+    EXPECT_FALSE(deque.push(&values[8]));
+    EXPECT_EQ(WorkStealingDeque<int>(1, true).room(), std::numeric_limits<size_t>::max());
+}
+
+TEST(WorkStealingDequeTest, SmallLocalQueuesSpillToGlobal) {
+    ThreadPoolOptions options;
+    options.num_threads = 2;
+    options.local_queue_capacity = 2;
+    options.local_queue_overflow = QueueOverflow::Spill;
+    LockFreeThreadPool pool(options);
+
+    std::atomic<int> count{0};
+    auto outer = pool.enqueue([&pool, &count]() {
+        // Far more children than the local deque holds.
+        for (int i = 0; i < 1000; ++i) {
+            pool.post([&count]() { count++; });
+        }
+    });
+    outer.get();
+    pool.wait();
+    EXPECT_EQ(count.load(), 1000);
+}
+
+TEST(WorkStealingDequeTest, GrowableDequeDoublesWhenFull) {
+    WorkStealingDeque<int> deque(4, true);
+    std::vector<int> values(100);
+
+    EXPECT_TRUE(deque.push(&values[0]));
+    EXPECT_EQ(deque.steal(), &values[0]);
+    for (int i = 1; i < 11; ++i) {
+        EXPECT_TRUE(deque.push(&values[i]));
+    }
+    EXPECT_EQ(deque.capacity(), 16u);
+    EXPECT_EQ(deque.size(), 10u);
+
+    std::vector<int*> items;
+    for (int i = 11; i < 100; ++i) {
+        items.push_back(&values[i]);
+    }
+    EXPECT_EQ(deque.push_bulk(items.data(), items.size()), items.size());
+    EXPECT_EQ(deque.capacity(), 128u);
+
+    // Order survives the copies: FIFO from the top, LIFO from the bottom.
+    EXPECT_EQ(deque.steal(), &values[1]);
+    EXPECT_EQ(deque.pop(), &values[99]);
+    for (int i = 98; i >= 2; --i) {
+        EXPECT_EQ(deque.pop(), &values[i]);
+    }
+    EXPECT_TRUE(deque.empty());
+}
+
+TEST(WorkStealingDequeTest, ConcurrentStealWhileGrowing) {
+    constexpr int item_count = 100000;
+    constexpr int thief_count = 3;
+
+    WorkStealingDeque<int> deque(2, true);
+    std::vector<int> items(item_count);
+    std::vector<std::atomic<int>> taken(item_count);
+    std::atomic<bool> done{false};
+
+    std::vector<std::thread> thieves;
+    for (int t = 0; t < thief_count; ++t) {
+        thieves.emplace_back([&]() {
+            while (!done.load(std::memory_order_acquire) || !deque.empty()) {
+                if (int* item = deque.steal()) {
+                    taken[item - items.data()].fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+    for (int i = 0; i < item_count; ++i) {
+        EXPECT_TRUE(deque.push(&items[i]));
+    }
+    done.store(true, std::memory_order_release);
+    for (auto& t : thieves) {
+        t.join();
+    }
+
+    for (int i = 0; i < item_count; ++i) {
+        ASSERT_EQ(taken[i].load(), 1) << "item " << i;
+    }
+}
+
+TEST(WorkStealingDequeTest, OverflowModesRunEverything) {
+    for (QueueOverflow mode : {QueueOverflow::Grow, QueueOverflow::RunInline, QueueOverflow::Spill}) {
+        ThreadPoolOptions options;
+        options.num_threads = 2;
+        options.local_queue_capacity = 4;
+        options.local_queue_overflow = mode;
+        LockFreeThreadPool pool(options);
+
+        // Each level queues its children before recursing, so the deque
+        // holds far more than its initial capacity.
+        std::atomic<int> count{0};
+        std::function<void(int)> descend = [&](int depth) {
+            TaskGroup group(pool);
+            for (int i = 0; i < 8; ++i) {
+                group.run([&count]() { count++; });
+            }
+            if (depth > 0) {
+                descend(depth - 1);
+            }
+            group.wait();
+        };
+        pool.enqueue(descend, 200).get();
+        EXPECT_EQ(count.load(), 201 * 8);
+    }
+}
+
+TEST(WorkStealingDequeTest, StealHalfMovesOldestHalf) {
+    WorkStealingDeque<int> victim(16);
+    WorkStealingDeque<int> thief(16);
+    int values[10] = {};
+    for (int& v : values) {
+        victim.push(&v);
+    }
+
+    EXPECT_EQ(victim.steal_half(thief), &values[0]);
+    EXPECT_EQ(victim.size(), 5u);
+    EXPECT_EQ(thief.size(), 4u);
+    EXPECT_EQ(thief.steal(), &values[1]);
+    EXPECT_EQ(thief.pop(), &values[4]);
+    EXPECT_EQ(victim.pop(), &values[9]);
+    EXPECT_EQ(victim.steal(), &values[5]);
+
+    // A full thief deque limits the batch instead of dropping tasks.
+    WorkStealingDeque<int> small(2);
+    int other[8] = {};
+    for (int& v : other) {
+        victim.push(&v);
+    }
+    EXPECT_NE(victim.steal_half(small), nullptr);
+    EXPECT_EQ(small.size(), 2u);
+
+    WorkStealingDeque<int> empty(4);
+    EXPECT_EQ(empty.steal_half(thief), nullptr);
+}
+
+TEST(WorkStealingDequeTest, ConcurrentStealHalfTakesEachItemOnce) {
+    constexpr int item_count = 200000;
+    constexpr int thief_count = 3;
+
+    WorkStealingDeque<int> deque(1024);
+    std::vector<int> items(item_count);
+    std::vector<std::atomic<int>> taken(item_count);
+    std::atomic<bool> done{false};
+
+    auto record = [&](int* item) {
+        taken[item - items.data()].fetch_add(1, std::memory_order_relaxed);
+    };
+
+    std::vector<std::thread> thieves;
+    for (int t = 0; t < thief_count; ++t) {
+        thieves.emplace_back([&]() {
+            WorkStealingDeque<int> own(256);
+            while (!done.load(std::memory_order_acquire) || !deque.empty()) {
+                if (int* item = deque.steal_half(own)) {
+                    record(item);
+                }
+                while (int* item = own.pop()) {
+                    record(item);
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < item_count; ++i) {
+        while (!deque.push(&items[i])) {
+            if (int* item = deque.pop()) {
+                record(item);
+            }
+        }
+        if (i % 3 == 0) {
+            if (int* item = deque.pop()) {
+                record(item);
+            }
+        }
+    }
+    while (int* item = deque.pop()) {
+        record(item);
+    }
+    done.store(true, std::memory_order_release);
+    for (auto& t : thieves) {
+        t.join();
+    }
+
+    for (int i = 0; i < item_count; ++i) {
+        ASSERT_EQ(taken[i].load(), 1) << "item " << i;
+    }
+}
+
+TEST(WorkStealingDequeTest, ConcurrentPopAndStealTakeEachItemOnce) {
+    constexpr int item_count = 200000;
+    constexpr int thief_count = 3;
+
+    WorkStealingDeque<int> deque(1024);
+    std::vector<int> items(item_count);
+    std::vector<std::atomic<int>> taken(item_count);
+    std::atomic<bool> done{false};
+
+    auto record = [&](int* item) {
+        taken[item - items.data()].fetch_add(1, std::memory_order_relaxed);
+    };
+
+    std::vector<std::thread> thieves;
+    for (int t = 0; t < thief_count; ++t) {
+        thieves.emplace_back([&]() {
+            while (!done.load(std::memory_order_acquire) || !deque.empty()) {
+                if (int* item = deque.steal()) {
+                    record(item);
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < item_count; ++i) {
+        while (!deque.push(&items[i])) {
+            if (int* item = deque.pop()) {
+                record(item);
+            }
+        }
+        if (i % 3 == 0) {
+            if (int* item = deque.pop()) {
+                record(item);
+            }
+        }
+    }
+    while (int* item = deque.pop()) {
+        record(item);
+    }
+    done.store(true, std::memory_order_release);
+
+    for (auto& t : thieves) {
+        t.join();
+    }
+
+    for (int i = 0; i < item_count; ++i) {
+        ASSERT_EQ(taken[i].load(), 1) << "item " << i;
+    }
+}
+
+struct QueueItem {
+    int value{0};
+    QueueItem* next{nullptr};
+};
+
+TEST(InjectionQueueTest, FifoAcrossRingAndOverflow) {
+    InjectionQueue<QueueItem> queue(4);
+    std::vector<QueueItem> items(10);
+    for (int i = 0; i < 10; ++i) {
+        items[i].value = i;
+        queue.push(&items[i]);
+    }
+    EXPECT_EQ(queue.size(), 10u);
+
+    std::vector<int> order;
+    QueueItem* batch[3];
+    while (size_t count = queue.pop_bulk(batch, 3)) {
+        EXPECT_LE(count, 3u);
+        for (size_t i = 0; i < count; ++i) {
+            order.push_back(batch[i]->value);
+        }
+    }
+
+    std::vector<int> expected(10);
+    std::iota(expected.begin(), expected.end(), 0);
+    EXPECT_EQ(order, expected);
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(InjectionQueueTest, PushBulkKeepsOrderWhenRingFills) {
+    InjectionQueue<QueueItem> queue(8);
+    std::vector<QueueItem> items(20);
+    std::vector<QueueItem*> pointers;
+    for (int i = 0; i < 20; ++i) {
+        items[i].value = i;
+        pointers.push_back(&items[i]);
+    }
+
+    queue.push(pointers[0]);
+    queue.push_bulk(pointers.data() + 1, 12);
+    queue.push_bulk(pointers.data() + 13, 7);
+    EXPECT_EQ(queue.size(), 20u);
+
+    std::vector<int> order;
+    while (QueueItem* item = queue.pop()) {
+        order.push_back(item->value);
+    }
+
+    std::vector<int> expected(20);
+    std::iota(expected.begin(), expected.end(), 0);
+    EXPECT_EQ(order, expected);
+}
+
+TEST(InjectionQueueTest, ConcurrentProducersAndBatchConsumers) {
+    constexpr int producer_count = 4;
+    constexpr int items_per_producer = 50000;
+    constexpr int total = producer_count * items_per_producer;
+
+    InjectionQueue<QueueItem> queue(1024);
+    std::vector<QueueItem> items(total);
+    std::vector<std::atomic<int>> seen(total);
+    std::atomic<int> consumed{0};
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producer_count; ++p) {
+        threads.emplace_back([&, p]() {
+            for (int i = 0; i < items_per_producer; ++i) {
+                int index = p * items_per_producer + i;
+                items[index].value = index;
+                queue.push(&items[index]);
+            }
+        });
+    }
+    for (int c = 0; c < 2; ++c) {
+        threads.emplace_back([&]() {
+            QueueItem* batch[16];
+            while (consumed.load() < total) {
+                size_t count = queue.pop_bulk(batch, 16);
+                for (size_t i = 0; i < count; ++i) {
+                    seen[batch[i]->value].fetch_add(1);
+                }
+                consumed.fetch_add(static_cast<int>(count));
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    for (int i = 0; i < total; ++i) {
+        ASSERT_EQ(seen[i].load(), 1) << "item " << i;
+    }
+}
+
+TEST(TargetedThreadPoolTest, ExternalSubmissionsRunInFifoOrder) {
+    LockFreeThreadPool pool(1);
+    constexpr int task_count = 500;
+
+    std::atomic<bool> release{false};
+    pool.enqueue([&release]() {
+        while (!release.load()) {
+            std::this_thread::yield();
+        }
+    });
+
+    std::vector<int> order;
+    order.reserve(task_count);
+    for (int i = 0; i < task_count; ++i) {
+        pool.enqueue([&order, i]() {
+            order.push_back(i);
+        });
+    }
+    release.store(true);
+    pool.wait();
+
+    ASSERT_EQ(order.size(), static_cast<size_t>(task_count));
+    EXPECT_TRUE(std::is_sorted(order.begin(), order.end()));
+}
+
+TEST(TargetedThreadPoolTest, ExternalSubmissionsStayFifoWithFixedDeques) {
+    // A batch claim larger than the deque must not put leftovers back
+    // behind newer submissions.
+    ThreadPoolOptions options;
+    options.num_threads = 1;
+    options.local_queue_capacity = 2;
+    options.local_queue_overflow = QueueOverflow::Spill;
+    LockFreeThreadPool pool(options);
+    constexpr int task_count = 500;
+
+    std::atomic<bool> release{false};
+    pool.enqueue([&release]() {
+        while (!release.load()) {
+            std::this_thread::yield();
+        }
+    });
+
+    std::vector<int> order;
+    order.reserve(task_count);
+    for (int i = 0; i < task_count; ++i) {
+        pool.post([&order, i]() {
+            order.push_back(i);
+        });
+    }
+    release.store(true);
+    pool.wait();
+
+    ASSERT_EQ(order.size(), static_cast<size_t>(task_count));
+    EXPECT_TRUE(std::is_sorted(order.begin(), order.end()));
+}
+
+TEST_F(ThreadPoolTest, EnqueueBulkReturnsFuturesInOrder) {
+    LockFreeThreadPool pool(4);
+    constexpr int task_count = 10000;
+    std::vector<std::function<int()>> jobs;
+    for (int i = 0; i < task_count; ++i) {
+        jobs.emplace_back([i]() { return i * 2; });
+    }
+    jobs.emplace_back([]() -> int { throw std::runtime_error("bulk failure"); });
+
+    auto futures = pool.enqueue_bulk(jobs.begin(), jobs.end());
+    ASSERT_EQ(futures.size(), jobs.size());
+    for (int i = 0; i < task_count; ++i) {
+        EXPECT_EQ(futures[i].get(), i * 2);
+    }
+    EXPECT_THROW(futures.back().get(), std::runtime_error);
+}
+
+TEST_F(ThreadPoolTest, EnqueueNRunsEveryIndexOnce) {
+    LockFreeThreadPool pool(4);
+    constexpr size_t task_count = 20000;
+    std::vector<std::atomic<int>> hits(task_count);
+
+    pool.enqueue_n(task_count, [&hits](size_t i) {
+        hits[i].fetch_add(1, std::memory_order_relaxed);
+    }).get();
+
+    for (size_t i = 0; i < task_count; ++i) {
+        ASSERT_EQ(hits[i].load(), 1) << "index " << i;
+    }
+
+    auto failing = pool.enqueue_n(100, [](size_t i) {
+        if (i == 42) {
+            throw std::runtime_error("index 42");
+        }
+    });
+    EXPECT_THROW(failing.get(), std::runtime_error);
+
+    pool.enqueue_n(0, [](size_t) {}).get();
+}
+
+TEST(TargetedThreadPoolTest, EnqueueNFromWorkerSpillsToGlobalQueue) {
+    LockFreeThreadPool pool(2);
+    std::atomic<size_t> total{0};
+
+    pool.enqueue([&pool, &total]() {
+        pool.enqueue_n(10000, [&total](size_t i) {
+            total.fetch_add(i, std::memory_order_relaxed);
+        });
+    }).get();
+    pool.wait();
+
+    EXPECT_EQ(total.load(), size_t{10000} * 9999 / 2);
+}
+
+TEST_F(ThreadPoolTest, ParallelForVisitsEveryIndexOnce) {
+    LockFreeThreadPool pool(4);
+    constexpr int count = 100000;
+    std::vector<std::atomic<int>> hits(count);
+
+    pool.parallel_for(0, count, [&hits](int i) {
+        hits[i].fetch_add(1, std::memory_order_relaxed);
+        if (i % 1000 == 0) {
+            std::this_thread::sleep_for(10us);
+        }
+    });
+
+    for (int i = 0; i < count; ++i) {
+        ASSERT_EQ(hits[i].load(), 1) << "index " << i;
+    }
+
+    bool touched = false;
+    pool.parallel_for(5, 5, [&touched](int) { touched = true; });
+    EXPECT_FALSE(touched);
+}
+
+TEST_F(ThreadPoolTest, ParallelForSplitsSkewedWorkAcrossWorkers) {
+    LockFreeThreadPool pool(4);
+    std::mutex mutex;
+    std::set<std::thread::id> threads_seen;
+
+    pool.parallel_for(size_t{0}, size_t{64}, [&](size_t i) {
+        // All the cost sits in the last quarter of the range.
+        if (i >= 48) {
+            std::this_thread::sleep_for(2ms);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        threads_seen.insert(std::this_thread::get_id());
+    });
+
+    EXPECT_GT(threads_seen.size(), 1u);
+}
+
+TEST_F(ThreadPoolTest, ParallelForPropagatesExceptions) {
+    LockFreeThreadPool pool(4);
+    std::atomic<int> visited{0};
+
+    EXPECT_THROW(pool.parallel_for(0, 100000, [&visited](int i) {
+        visited.fetch_add(1, std::memory_order_relaxed);
+        if (i == 500) {
+            throw std::runtime_error("bad index");
+        }
+    }), std::runtime_error);
+
+    EXPECT_LT(visited.load(), 100000);
+    pool.wait();
+    EXPECT_EQ(pool.pending_tasks(), 0u);
+}
+
+TEST_F(ThreadPoolTest, NestedParallelForInsideTasks) {
+    LockFreeThreadPool pool(2);
+    constexpr int outer = 8;
+    constexpr int inner = 5000;
+    std::atomic<long> total{0};
+
+    std::vector<TaskFuture<void>> futures;
+    for (int i = 0; i < outer; ++i) {
+        futures.push_back(pool.enqueue([&pool, &total]() {
+            pool.parallel_for(0, inner, [&total](int j) {
+                total.fetch_add(j, std::memory_order_relaxed);
+            });
+        }));
+    }
+    for (auto& f : futures) {
+        f.get();
+    }
+
+    EXPECT_EQ(total.load(), static_cast<long>(outer) * inner * (inner - 1) / 2);
+}
+
+TEST_F(ThreadPoolTest, ParallelReduceSumsRange) {
+    LockFreeThreadPool pool(4);
+
+    long long sum = pool.parallel_reduce(0LL, 1000000LL, 0LL,
+        [](long long i) { return i; },
+        [](long long a, long long b) { return a + b; });
+    EXPECT_EQ(sum, 1000000LL * 999999LL / 2);
+
+    int empty = pool.parallel_reduce(3, 3, 7,
+        [](int) { return 1; },
+        [](int a, int b) { return a + b; });
+    EXPECT_EQ(empty, 7);
+}
+
+TEST_F(ThreadPoolTest, ParallelReduceWithNonTrivialAccumulator) {
+    LockFreeThreadPool pool(4);
+    constexpr int count = 20000;
+
+    // Per-bucket histogram: vectors are combined element-wise.
+    auto histogram = pool.parallel_reduce(0, count, std::vector<int>(10, 0),
+        [](int i) {
+            std::vector<int> one(10, 0);
+            one[i % 10] = 1;
+            return one;
+        },
+        [](std::vector<int> a, const std::vector<int>& b) {
+            for (size_t k = 0; k < a.size(); ++k) {
+                a[k] += b[k];
+            }
+            return a;
+        });
+
+    ASSERT_EQ(histogram.size(), 10u);
+    for (int bucket : histogram) {
+        EXPECT_EQ(bucket, count / 10);
+    }
+}
+
+TEST_F(ThreadPoolTest, ParallelReducePropagatesExceptionsAndNests) {
+    LockFreeThreadPool pool(2);
+
+    EXPECT_THROW(pool.parallel_reduce(0, 100000, 0,
+        [](int i) -> int {
+            if (i == 777) {
+                throw std::runtime_error("map failed");
+            }
+            return 1;
+        },
+        [](int a, int b) { return a + b; }), std::runtime_error);
+
+    auto outer = pool.enqueue([&pool]() {
+        return pool.parallel_reduce(0, 100, 0LL,
+            [&pool](int i) {
+                return pool.parallel_reduce(0, 100, 0LL,
+                    [i](int j) { return static_cast<long long>(i * 100 + j); },
+                    [](long long a, long long b) { return a + b; });
+            },
+            [](long long a, long long b) { return a + b; });
+    });
+    EXPECT_EQ(outer.get(), 10000LL * 9999LL / 2);
+}
+
+long long recursive_future_sum(LockFreeThreadPool& pool, long long start, long long end) {
+    if (end - start <= 16) {
+        long long total = 0;
+        for (long long i = start; i <= end; ++i) {
+            total += i;
+        }
+        return total;
+    }
+    long long mid = start + (end - start) / 2;
+    auto left = pool.enqueue(recursive_future_sum, std::ref(pool), start, mid);
+    auto right = pool.enqueue(recursive_future_sum, std::ref(pool), mid + 1, end);
+    return left.get() + right.get();
+}
+
+TEST(TargetedThreadPoolTest, NestedGetDoesNotBlockWorkers) {
+    // Every level waits on its children from inside a worker. With blocking
+    // waits a single worker would deadlock on the very first get().
+    for (size_t threads : {1u, 2u}) {
+        LockFreeThreadPool pool(threads);
+        const long long n = 20000;
+        long long sum = pool.enqueue(recursive_future_sum, std::ref(pool), 1LL, n).get();
+        EXPECT_EQ(sum, n * (n + 1) / 2) << threads << " threads";
+    }
+}
+
+TEST(TargetedThreadPoolTest, WorkerWaitsOnFutureOfAnotherPool) {
+    LockFreeThreadPool producer(1);
+    LockFreeThreadPool consumer(1);
+
+    std::atomic<bool> release{false};
+    auto slow = producer.enqueue([&release]() {
+        while (!release.load()) {
+            std::this_thread::yield();
+        }
+        return 5;
+    });
+
+    auto waiter = consumer.enqueue([&slow]() { return slow.get() * 2; });
+    auto unrelated = consumer.enqueue([]() { return 1; });
+
+    // The waiting worker keeps serving its own pool meanwhile.
+    EXPECT_EQ(unrelated.get(), 1);
+    release.store(true);
+    EXPECT_EQ(waiter.get(), 10);
+}
+
+TEST(TargetedThreadPoolTest, StolenChildWakesParkedParentPromptly) {
+    using Clock = std::chrono::steady_clock;
+    LockFreeThreadPool pool(2);
+    constexpr int rounds = 21;
+
+    // The parent spawns a child, waits until the other worker has stolen
+    // it, then joins; with nothing left to run it parks. The child's
+    // completion must wake it, not a timeout.
+    auto join_lag = [&pool](bool use_group) {
+        return pool.enqueue([&pool, use_group]() {
+            std::atomic<bool> started{false};
+            Clock::time_point finished;
+            auto child = [&started, &finished]() {
+                started = true;
+                std::this_thread::sleep_for(std::chrono::milliseconds(3));
+                finished = Clock::now();
+            };
+            if (use_group) {
+                TaskGroup group(pool);
+                group.run(child);
+                while (!started.load()) {
+                    std::this_thread::yield();
+                }
+                group.wait();
+            } else {
+                TaskFuture<void> future = pool.enqueue(child);
+                while (!started.load()) {
+                    std::this_thread::yield();
+                }
+                future.get();
+            }
+            return Clock::now() - finished;
+        }).get();
+    };
+
+    for (bool use_group : {false, true}) {
+        std::vector<Clock::duration> lags;
+        for (int i = 0; i < rounds; ++i) {
+            lags.push_back(join_lag(use_group));
+        }
+        std::sort(lags.begin(), lags.end());
+        EXPECT_LT(lags[rounds / 2], std::chrono::microseconds(300)) << (use_group ? "group" : "future");
+    }
+}
+
+TEST(TargetedThreadPoolTest, IdleWaitingWorkerParks) {
+    LockFreeThreadPool producer(1);
+    LockFreeThreadPool consumer(1);
+
+    auto slow = producer.enqueue([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        return 5;
+    });
+
+    // With nothing to run the waiting worker should sleep, not spin.
+    auto cpu_seconds = []() {
+        timespec now{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return static_cast<double>(now.tv_sec) + static_cast<double>(now.tv_nsec) * 1e-9;
+    };
+    auto waiter = consumer.enqueue([&slow, &cpu_seconds]() {
+        double before = cpu_seconds();
+        int value = slow.get();
+        return std::make_pair(value, cpu_seconds() - before);
+    });
+
+    auto [value, cpu] = waiter.get();
+    EXPECT_EQ(value, 5);
+    EXPECT_LT(cpu, 0.05);
+}
+
+TEST(TaskGroupTest, WaitsForAllTasksAndIsReusable) {
+    LockFreeThreadPool pool(4);
+    std::atomic<int> counter{0};
+
+    TaskGroup group(pool);
+    for (int round = 1; round <= 3; ++round) {
+        for (int i = 0; i < 1000; ++i) {
+            group.run([&counter]() { counter.fetch_add(1, std::memory_order_relaxed); });
+        }
+        group.wait();
+        EXPECT_EQ(counter.load(), round * 1000);
+    }
+}
+
+TEST(TaskGroupTest, RethrowsFirstExceptionOnce) {
+    LockFreeThreadPool pool(4);
+    std::atomic<int> completed{0};
+
+    TaskGroup group(pool);
+    for (int i = 0; i < 100; ++i) {
+        group.run([&completed, i]() {
+            if (i % 10 == 3) {
+                throw std::runtime_error("group task failed");
+            }
+            completed.fetch_add(1);
+        });
+    }
+    EXPECT_THROW(group.wait(), std::runtime_error);
+    EXPECT_EQ(completed.load(), 90);
+
+    group.run([]() {});
+    EXPECT_NO_THROW(group.wait());
+}
+
+int group_fib(LockFreeThreadPool& pool, int n) {
+    if (n < 2) {
+        return n;
+    }
+    int a = 0;
+    int b = 0;
+    TaskGroup group(pool);
+    group.run([&pool, &a, n]() { a = group_fib(pool, n - 1); });
+    group.run([&pool, &b, n]() { b = group_fib(pool, n - 2); });
+    group.wait();
+    return a + b;
+}
+
+TEST(TaskGroupTest, NestsInsideTasks) {
+    LockFreeThreadPool pool(2);
+    EXPECT_EQ(pool.enqueue(group_fib, std::ref(pool), 18).get(), 2584);
+}
+
+TEST(TaskGroupTest, DestructionCancelsTasksNotYetStarted) {
+    LockFreeThreadPool pool(1);
+    std::atomic<bool> release{false};
+    std::atomic<int> ran{0};
+
+    pool.post([&release]() {
+        while (!release.load()) {
+            std::this_thread::yield();
+        }
+    });
+
+    std::thread releaser([&release]() {
+        std::this_thread::sleep_for(20ms);
+        release.store(true);
+    });
+    {
+        TaskGroup group(pool);
+        for (int i = 0; i < 100; ++i) {
+            group.run([&ran]() { ran.fetch_add(1); });
+        }
+        EXPECT_FALSE(group.is_cancelled());
+    }
+    releaser.join();
+
+    EXPECT_EQ(ran.load(), 0);
+    pool.wait();
+    EXPECT_EQ(ran.load(), 0);
+}
+
+TEST(TaskGroupTest, ExternalWaitRunsTasksInline) {
+    LockFreeThreadPool pool(1);
+    std::atomic<bool> started{false};
+    std::atomic<bool> release{false};
+    pool.post([&started, &release]() {
+        started = true;
+        while (!release.load()) {
+            std::this_thread::yield();
+        }
+    });
+    while (!started.load()) {
+        std::this_thread::yield();
+    }
+
+    // The only worker is busy, so wait() has to run the tasks itself.
+    TaskGroup group(pool);
+    std::atomic<int> ran{0};
+    std::thread::id caller = std::this_thread::get_id();
+    std::atomic<bool> inline_run{false};
+    for (int i = 0; i < 10; ++i) {
+        group.run([&]() {
+            ran.fetch_add(1);
+            if (std::this_thread::get_id() == caller) {
+                inline_run = true;
+            }
+        });
+    }
+    group.wait();
+    EXPECT_EQ(ran.load(), 10);
+    EXPECT_TRUE(inline_run.load());
+
+    release.store(true);
+}
+
+TEST(TaskGroupTest, ExternalWaiterIsAlwaysWoken) {
+    LockFreeThreadPool pool(4);
+    for (int round = 0; round < 2000; ++round) {
+        TaskGroup group(pool);
+        std::atomic<int> ran{0};
+        // Tasks spawned from a worker land on its deque, where the external
+        // waiter cannot take them, so it has to sleep and be woken.
+        group.run([&]() {
+            for (int i = 0; i < 4; ++i) {
+                group.run([&ran]() { ran.fetch_add(1); });
+            }
+            ran.fetch_add(1);
+        });
+        group.wait();
+        ASSERT_EQ(ran.load(), 5) << "round " << round;
+    }
+}
+
+TEST(TaskGroupTest, ExternalWaitSkipsForeignQueuedTasks) {
+    LockFreeThreadPool pool(1);
+    std::atomic<bool> started{false};
+    std::atomic<bool> release{false};
+    pool.post([&started, &release]() {
+        started = true;
+        while (!release.load()) {
+            std::this_thread::yield();
+        }
+    });
+    while (!started.load()) {
+        std::this_thread::yield();
+    }
+
+    // Queued ahead of the group's task by another outside thread.
+    std::atomic<bool> foreign_ran{false};
+    TaskFuture<void> foreign = pool.enqueue([&foreign_ran]() { foreign_ran = true; });
+
+    std::atomic<int> ran{0};
+    std::thread waiter([&]() {
+        TaskGroup group(pool);
+        group.run([&ran]() { ran.fetch_add(1); });
+        group.wait();
+    });
+    waiter.join();
+    EXPECT_EQ(ran.load(), 1);
+    EXPECT_FALSE(foreign_ran.load());
+
+    release.store(true);
+    foreign.get();
+    EXPECT_TRUE(foreign_ran.load());
+}
+
+TEST(TaskGroupTest, ExternalWaitRunsOnlyItsOwnTasks) {
+    // Run under TSan as well: a foreign reduce split run by the drainer would
+    // share the caller's partial slot with it.
+    LockFreeThreadPool pool(2);
+    std::atomic<bool> stop{false};
+    std::atomic<std::thread::id> drainer{};
+    std::atomic<bool> foreign_run{false};
+    std::thread other([&]() {
+        drainer = std::this_thread::get_id();
+        while (!stop.load()) {
+            TaskGroup group(pool);
+            group.run([]() { std::this_thread::yield(); });
+            group.wait();
+        }
+    });
+    while (drainer.load() == std::thread::id{}) {
+        std::this_thread::yield();
+    }
+
+    for (int round = 0; round < 200; ++round) {
+        long long sum = pool.parallel_reduce(0, 20000, 0LL,
+            [&](int i) {
+                if (std::this_thread::get_id() == drainer.load(std::memory_order_relaxed)) {
+                    foreign_run = true;
+                }
+                return static_cast<long long>(i);
+            },
+            [](long long a, long long b) { return a + b; });
+        ASSERT_EQ(sum, 20000LL * 19999 / 2) << "round " << round;
+    }
+    stop = true;
+    other.join();
+    EXPECT_FALSE(foreign_run.load());
+}
+
+long long invoke_fib(LockFreeThreadPool& pool, int n) {
+    if (n < 2) {
+        return n;
+    }
+    long long a = 0;
+    long long b = 0;
+    pool.parallel_invoke([&]() { a = invoke_fib(pool, n - 1); },
+                         [&]() { b = invoke_fib(pool, n - 2); });
+    return a + b;
+}
+
+TEST(ParallelInvokeTest, RecursiveFibonacci) {
+    for (size_t threads : {1u, 4u}) {
+        LockFreeThreadPool pool(threads);
+        EXPECT_EQ(pool.enqueue(invoke_fib, std::ref(pool), 22).get(), 17711) << threads << " threads";
+        EXPECT_EQ(invoke_fib(pool, 20), 6765) << "external caller, " << threads << " threads";
+        pool.wait();
+        EXPECT_EQ(pool.pending_tasks(), 0u);
+    }
+}
+
+TEST(ParallelInvokeTest, RunsEveryBranchAndRethrows) {
+    LockFreeThreadPool pool(4);
+    std::array<std::atomic<int>, 4> hits{};
+
+    pool.parallel_invoke([&]() { hits[0]++; },
+                         [&]() { hits[1]++; },
+                         [&]() { hits[2]++; },
+                         [&]() { hits[3]++; });
+    for (auto& h : hits) {
+        EXPECT_EQ(h.load(), 1);
+    }
+
+    int single = 0;
+    pool.parallel_invoke([&single]() { single = 7; });
+    EXPECT_EQ(single, 7);
+
+    std::atomic<int> finished{0};
+    EXPECT_THROW(pool.parallel_invoke(
+        [&finished]() { std::this_thread::sleep_for(5ms); finished++; },
+        []() { throw std::runtime_error("branch failed"); },
+        [&finished]() { finished++; }), std::runtime_error);
+    EXPECT_EQ(finished.load(), 2);
+}
+
+TEST(ContinuationTest, ThenChainsValuesAndVoid) {
+    LockFreeThreadPool pool(4);
+
+    auto result = pool.enqueue([]() { return 2; })
+        .then([](int x) { return x * 3; })
+        .then([](int x) { return std::to_string(x + 1); });
+    EXPECT_EQ(result.get(), "7");
+
+    std::atomic<int> steps{0};
+    auto done = pool.enqueue([&steps]() { steps++; })
+        .then([&steps]() { steps++; return 5; })
+        .then([&steps](int x) { steps += x; });
+    done.get();
+    EXPECT_EQ(steps.load(), 7);
+}
+
+TEST(ContinuationTest, ThenSkipsBodyOnFailureAndAttachesToReadyFutures) {
+    LockFreeThreadPool pool(2);
+
+    bool called = false;
+    auto failed = pool.enqueue([]() -> int { throw std::runtime_error("source failed"); })
+        .then([&called](int x) { called = true; return x; });
+    EXPECT_THROW(failed.get(), std::runtime_error);
+    EXPECT_FALSE(called);
+
+    auto ready = pool.enqueue([]() { return 10; });
+    ready.wait();
+    EXPECT_EQ(ready.then([](int x) { return x + 1; }).get(), 11);
+}
+
+TEST(ContinuationTest, ThenDoesNotBlockTheOnlyWorker) {
+    // With one worker, a blocking "wait then continue" would need a second
+    // thread; a continuation just runs after its source.
+    LockFreeThreadPool pool(1);
+    auto current = pool.enqueue([]() { return 0; });
+    for (int i = 0; i < 1000; ++i) {
+        current = std::move(current).then([](int x) { return x + 1; });
+    }
+    EXPECT_EQ(current.get(), 1000);
+}
+
+TEST(ContinuationTest, WhenAllJoinsEveryResult) {
+    LockFreeThreadPool pool(4);
+    std::vector<TaskFuture<int>> futures;
+    for (int i = 0; i < 100; ++i) {
+        futures.push_back(pool.enqueue([i]() { return i; }));
+    }
+
+    auto total = when_all(std::move(futures)).then([](std::vector<TaskFuture<int>> ready) {
+        int sum = 0;
+        for (auto& f : ready) {
+            EXPECT_TRUE(f.is_ready());
+            sum += f.get();
+        }
+        return sum;
+    });
+    EXPECT_EQ(total.get(), 4950);
+
+    auto empty = when_all(std::vector<TaskFuture<void>>{});
+    EXPECT_TRUE(empty.is_ready());
+    EXPECT_TRUE(empty.get().empty());
+}
+
+TEST(ContinuationTest, WhenAnyReportsFirstCompletion) {
+    LockFreeThreadPool pool(4);
+    std::atomic<bool> release{false};
+
+    std::vector<TaskFuture<int>> futures;
+    for (int i = 0; i < 3; ++i) {
+        futures.push_back(pool.enqueue([&release, i]() {
+            while (!release.load()) {
+                std::this_thread::yield();
+            }
+            return i;
+        }));
+    }
+    futures.push_back(pool.enqueue([]() { return 42; }));
+
+    auto first = when_any(std::move(futures)).get();
+    EXPECT_EQ(first.index, 3u);
+    ASSERT_EQ(first.futures.size(), 4u);
+    EXPECT_EQ(first.futures[3].get(), 42);
+
+    release.store(true);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(first.futures[i].get(), i);
+    }
+}
+
+TEST(ContinuationTest, WhenAnyLosersCanBeChained) {
+    LockFreeThreadPool pool(4);
+    std::atomic<bool> release{false};
+
+    auto slow = [&pool, &release](int value) {
+        return pool.enqueue([&release, value]() {
+            while (!release.load()) {
+                std::this_thread::yield();
+            }
+            return value;
+        });
+    };
+    std::vector<TaskFuture<int>> futures;
+    futures.push_back(pool.enqueue([]() { return 1; }));
+    futures.push_back(slow(2));
+    futures.push_back(slow(3));
+
+    auto first = when_any(std::move(futures)).get();
+    ASSERT_EQ(first.index, 0u);
+
+    // The losers are still pending; their continuation slots must be free.
+    auto doubled = std::move(first.futures[1]).then([](int v) { return v * 2; });
+    std::vector<TaskFuture<int>> rest;
+    rest.push_back(std::move(first.futures[2]));
+    auto joined = when_any(std::move(rest));
+    EXPECT_FALSE(doubled.is_ready());
+
+    release.store(true);
+    EXPECT_EQ(doubled.get(), 4);
+    auto last = joined.get();
+    EXPECT_EQ(last.futures[0].get(), 3);
+}
+
+TEST(TaskGraphTest, RespectsDependencies) {
+    LockFreeThreadPool pool(4);
+    std::mutex mutex;
+    std::vector<char> order;
+    auto record = [&](char name) {
+        return [&, name]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(name);
+        };
+    };
+
+    // Diamond: a -> {b, c} -> d
+    TaskGraph graph;
+    auto a = graph.add(record('a'));
+    auto b = graph.add(record('b'));
+    auto c = graph.add(record('c'));
+    auto d = graph.add(record('d'));
+    graph.precede(a, b);
+    graph.precede(a, c);
+    graph.precede(b, d);
+    graph.precede(c, d);
+
+    graph.run(pool);
+    ASSERT_EQ(order.size(), 4u);
+    EXPECT_EQ(order.front(), 'a');
+    EXPECT_EQ(order.back(), 'd');
+}
+
+TEST(TaskGraphTest, RerunsWithoutAllocatingTaskNodes) {
+    LockFreeThreadPool pool(4);
+    constexpr int width = 8;
+    constexpr int depth = 32;
+    std::vector<std::atomic<int>> runs(width * depth);
+    std::atomic<bool> ordered{true};
+
+    TaskGraph graph;
+    for (int layer = 0; layer < depth; ++layer) {
+        for (int i = 0; i < width; ++i) {
+            int index = layer * width + i;
+            graph.add([&runs, &ordered, index, layer]() {
+                if (layer > 0 && runs[index - width].load() != runs[index].load() + 1) {
+                    ordered.store(false);
+                }
+                runs[index].fetch_add(1);
+            });
+            if (layer > 0) {
+                for (int j = 0; j < width; ++j) {
+                    graph.precede((layer - 1) * width + j, index);
+                }
+            }
+        }
+    }
+
+    graph.run(pool);
+    size_t nodes_after_first_run = pool.allocated_task_nodes();
+    for (int r = 1; r < 50; ++r) {
+        graph.run(pool);
+    }
+
+    EXPECT_TRUE(ordered.load());
+    for (auto& count : runs) {
+        EXPECT_EQ(count.load(), 50);
+    }
+    EXPECT_EQ(pool.allocated_task_nodes(), nodes_after_first_run);
+}
+
+TEST(TaskGraphTest, RunsInsideTasksAndPropagatesErrors) {
+    LockFreeThreadPool pool(1);
+    std::atomic<int> ran{0};
+
+    TaskGraph graph;
+    auto first = graph.add([&ran]() { ran++; });
+    auto failing = graph.add([]() { throw std::runtime_error("stage failed"); });
+    auto last = graph.add([&ran]() { ran++; });
+    graph.precede(first, failing);
+    graph.precede(failing, last);
+
+    EXPECT_THROW(pool.enqueue([&]() { graph.run(pool); }).get(), std::runtime_error);
+    EXPECT_EQ(ran.load(), 1);
+
+    TaskGraph cyclic;
+    auto x = cyclic.add([]() {});
+    auto y = cyclic.add([]() {});
+    cyclic.precede(x, y);
+    cyclic.precede(y, x);
+    EXPECT_THROW(cyclic.run(pool), std::logic_error);
+}
+
+// Occupies the only worker of a pool until release is set.
+static void block_worker(LockFreeThreadPool& pool, std::atomic<bool>& release) {
+    std::atomic<bool> started{false};
+    pool.post([&started, &release]() {
+        started = true;
+        while (!release.load()) {
+            std::this_thread::yield();
+        }
+    });
+    while (!started.load()) {
+        std::this_thread::yield();
+    }
+}
+
+TEST(PriorityTest, HigherLevelsRunFirst) {
+    LockFreeThreadPool pool(1);
+    std::atomic<bool> release{false};
+    block_worker(pool, release);
+
+    std::vector<int> order;
+    pool.post_with_priority(TaskPriority::Low, [&order]() { order.push_back(2); });
+    pool.post([&order]() { order.push_back(1); });
+    pool.post_with_priority(TaskPriority::High, [&order]() { order.push_back(0); });
+    auto high = pool.enqueue_with_priority(TaskPriority::High, [&order]() {
+        order.push_back(0);
+        return 7;
+    });
+
+    release = true;
+    EXPECT_EQ(high.get(), 7);
+    pool.wait();
+    EXPECT_EQ(order, (std::vector<int>{0, 0, 1, 2}));
+}
+
+TEST(PriorityTest, AgingLetsLowPriorityWorkThrough) {
+    LockFreeThreadPool pool(1);
+    std::atomic<bool> release{false};
+    block_worker(pool, release);
+
+    constexpr int high_count = 500;
+    int high_done = 0;
+    int high_done_before_low = -1;
+    pool.post_with_priority(TaskPriority::Low, [&]() { high_done_before_low = high_done; });
+    for (int i = 0; i < high_count; ++i) {
+        pool.post_with_priority(TaskPriority::High, [&high_done]() { high_done++; });
+    }
+
+    release = true;
+    pool.wait();
+    EXPECT_EQ(high_done, high_count);
+    EXPECT_GE(high_done_before_low, 0);
+    EXPECT_LT(high_done_before_low, high_count);
+}
+
+TEST(PriorityTest, SpawnedTasksInheritPriority) {
+    LockFreeThreadPool pool(1);
+    std::atomic<bool> release{false};
+    std::vector<std::string> order;
+
+    std::atomic<bool> started{false};
+    pool.post_with_priority(TaskPriority::High, [&]() {
+        started = true;
+        while (!release.load()) {
+            std::this_thread::yield();
+        }
+        pool.post([&order]() { order.push_back("child"); });
+    });
+    while (!started.load()) {
+        std::this_thread::yield();
+    }
+    for (int i = 0; i < 3; ++i) {
+        pool.post([&order]() { order.push_back("normal"); });
+    }
+
+    release = true;
+    pool.wait();
+    ASSERT_EQ(order.size(), 4u);
+    EXPECT_EQ(order.front(), "child");
+}
+
+TEST(DeadlineTest, EarliestDeadlineRunsFirst) {
+    LockFreeThreadPool pool(1);
+    std::atomic<bool> release{false};
+    block_worker(pool, release);
+
+    auto now = std::chrono::steady_clock::now();
+    std::vector<int> order;
+    pool.post([&order]() { order.push_back(0); });
+    auto late = pool.enqueue_with_deadline(now + 30s, [&order]() { order.push_back(3); });
+    auto soon = pool.enqueue_with_deadline(now + 10s, [&order]() { order.push_back(1); });
+    auto mid = pool.enqueue_with_deadline(now + 20s, [&order]() {
+        order.push_back(2);
+        return 5;
+    });
+
+    release = true;
+    EXPECT_EQ(mid.get(), 5);
+    pool.wait();
+    EXPECT_EQ(order, (std::vector<int>{1, 2, 3, 0}));
+}
+
+TEST(DeadlineTest, ExpiredTasksAreDropped) {
+    LockFreeThreadPool pool(1);
+    std::atomic<bool> release{false};
+    block_worker(pool, release);
+
+    std::atomic<bool> ran{false};
+    auto expired = pool.enqueue_with_deadline(std::chrono::steady_clock::now() + 10ms,
+                                              [&ran]() { ran = true; });
+    auto alive = pool.enqueue_with_deadline(std::chrono::steady_clock::now() + 60s,
+                                            [](int x) { return x * 2; }, 21);
+    std::this_thread::sleep_for(30ms);
+
+    release = true;
+    EXPECT_THROW(expired.get(), DeadlineExpiredError);
+    EXPECT_EQ(alive.get(), 42);
+    EXPECT_FALSE(ran.load());
+}
+
+TEST(TimerWheelTest, FiresEveryNodeOnItsTickAndSupportsRemoval) {
+    constexpr size_t count = 20000;
+    std::mt19937_64 rng(7);
+    std::vector<TimerWheel::Node> nodes(count);
+    std::vector<bool> fired(count, false);
+    std::vector<bool> removed(count, false);
+
+    TimerWheel wheel(1000);
+    for (auto& node : nodes) {
+        // Mostly near, some far enough to start out on the top levels.
+        uint64_t delay = rng() % 4 == 0 ? rng() % (uint64_t{1} << 32) : rng() % 100000;
+        node.due = 1000 + delay;
+        wheel.insert(&node);
+    }
+    for (size_t i = 0; i < count; i += 3) {
+        wheel.remove(&nodes[i]);
+        removed[i] = true;
+    }
+    EXPECT_EQ(wheel.size(), count - (count + 2) / 3);
+
+    uint64_t previous = wheel.current() - 1;
+    while (!wheel.empty()) {
+        uint64_t next = wheel.next_event();
+        ASSERT_NE(next, TimerWheel::NEVER);
+        uint64_t now = next + rng() % 50;
+        wheel.advance(now, [&](TimerWheel::Node* node) {
+            size_t index = static_cast<size_t>(node - nodes.data());
+            EXPECT_FALSE(fired[index]);
+            EXPECT_LE(node->due, now);
+            EXPECT_GT(node->due, previous);
+            fired[index] = true;
+        });
+        previous = now;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        EXPECT_NE(fired[i], removed[i]) << i;
+    }
+}
+
+TEST(TimerTest, EnqueueAfterWaitsForTheDelay) {
+    LockFreeThreadPool pool(2);
+    // Let the workers park so the timekeeper path is exercised.
+    std::this_thread::sleep_for(20ms);
+
+    auto start = std::chrono::steady_clock::now();
+    auto future = pool.enqueue_after(30ms, [start]() { return std::chrono::steady_clock::now() - start; });
+    auto at = pool.enqueue_at(start + 10ms, []() { return 1; });
+    EXPECT_GE(future.get(), 30ms);
+    EXPECT_EQ(at.get(), 1);
+
+    // A worker blocked on a timer future keeps firing timers.
+    LockFreeThreadPool single(1);
+    auto nested = single.enqueue([&single]() { return single.enqueue_after(5ms, []() { return 2; }).get(); });
+    EXPECT_EQ(nested.get(), 2);
+}
+
+TEST(TimerTest, CancelledTimersDoNotRun) {
+    LockFreeThreadPool pool(2);
+    std::atomic<bool> ran{false};
+
+    TimerHandle handle = pool.post_after(30ms, [&ran]() { ran = true; });
+    EXPECT_TRUE(handle.active());
+    EXPECT_TRUE(handle.cancel());
+    EXPECT_FALSE(handle.cancel());
+    EXPECT_FALSE(handle.active());
+
+    std::atomic<bool> fired{false};
+    TimerHandle quick = pool.post_after(1ms, [&fired]() { fired = true; });
+    std::this_thread::sleep_for(50ms);
+    EXPECT_FALSE(ran.load());
+    EXPECT_TRUE(fired.load());
+    EXPECT_FALSE(quick.cancel());
+}
+
+TEST(TimerTest, ScheduleEveryRepeatsUntilCancelled) {
+    LockFreeThreadPool pool(2);
+    std::atomic<int> runs{0};
+
+    TimerHandle handle = pool.schedule_every(2ms, [&runs]() { runs++; });
+    auto give_up = std::chrono::steady_clock::now() + 5s;
+    while (runs.load() < 5 && std::chrono::steady_clock::now() < give_up) {
+        std::this_thread::sleep_for(1ms);
+    }
+    EXPECT_GE(runs.load(), 5);
+
+    EXPECT_TRUE(handle.cancel());
+    pool.wait();
+    int after_cancel = runs.load();
+    std::this_thread::sleep_for(20ms);
+    EXPECT_EQ(runs.load(), after_cancel);
+}
+
+TEST(TimerTest, CancelBetweenFireAndRunSkipsTheRun) {
+    // Two timers created together fire in the same tick, and the single
+    // worker queues both runs before starting either. The first to run
+    // cancels the other, whose run is then already queued.
+    LockFreeThreadPool pool(1);
+    for (int round = 0; round < 20; ++round) {
+        std::atomic<bool> armed{false};
+        std::atomic<bool> cancelled[2] = {false, false};
+        std::atomic<int> runs_after_cancel{0};
+        TimerHandle handles[2];
+        for (int i = 0; i < 2; ++i) {
+            handles[i] = pool.schedule_every(1ms, [&, i]() {
+                if (!armed.load()) {
+                    return;
+                }
+                if (cancelled[i].load()) {
+                    runs_after_cancel++;
+                }
+                if (handles[1 - i].cancel()) {
+                    cancelled[1 - i] = true;
+                }
+            });
+        }
+        armed = true;
+
+        auto give_up = std::chrono::steady_clock::now() + 5s;
+        while (!cancelled[0].load() && !cancelled[1].load() && std::chrono::steady_clock::now() < give_up) {
+            std::this_thread::sleep_for(1ms);
+        }
+        std::this_thread::sleep_for(3ms);
+        handles[0].cancel();
+        handles[1].cancel();
+        pool.wait();
+        ASSERT_EQ(runs_after_cancel.load(), 0) << "round " << round;
+    }
+}
+
+TEST(TimerTest, DestroyingThePoolDropsPendingTimers) {
+    TimerHandle periodic;
+    TaskFuture<int> pending;
+    {
+        LockFreeThreadPool pool(1);
+        periodic = pool.schedule_every(1h, []() {});
+        pending = pool.enqueue_after(1h, []() { return 1; });
+    }
+    EXPECT_FALSE(periodic.active());
+    EXPECT_FALSE(periodic.cancel());
+    EXPECT_THROW(pending.get(), std::future_error);
+}
+
+TEST(CancellationTest, TokensFollowTheirParents) {
+    CancellationSource root;
+    CancellationSource child(root.token());
+    CancellationSource grandchild(child.token());
+    CancellationToken never;
+
+    EXPECT_FALSE(grandchild.is_cancelled());
+    child.cancel();
+    EXPECT_TRUE(grandchild.token().is_cancelled());
+    EXPECT_TRUE(child.is_cancelled());
+    EXPECT_FALSE(root.is_cancelled());
+    EXPECT_THROW(grandchild.token().throw_if_cancelled(), TaskCancelledError);
+    EXPECT_FALSE(never.is_cancelled());
+    EXPECT_FALSE(CancellationToken::current().is_cancelled());
+}
+
+TEST(CancellationTest, QueuedTasksAreSkippedAndRunningOnesCanPoll) {
+    LockFreeThreadPool pool(1);
+    std::atomic<bool> release{false};
+    block_worker(pool, release);
+
+    CancellationSource source;
+    std::atomic<int> ran{0};
+    std::vector<TaskFuture<int>> futures;
+    for (int i = 0; i < 10; ++i) {
+        futures.push_back(pool.enqueue_cancellable(source.token(), [&ran](int x) {
+            ran++;
+            return x;
+        }, i));
+    }
+    source.cancel();
+    release = true;
+    for (auto& future : futures) {
+        EXPECT_THROW(future.get(), TaskCancelledError);
+    }
+    EXPECT_EQ(ran.load(), 0);
+
+    CancellationSource running;
+    std::atomic<bool> started{false};
+    auto polling = pool.enqueue_cancellable(running.token(), [&started]() {
+        started = true;
+        int rounds = 0;
+        while (!CancellationToken::current().is_cancelled()) {
+            std::this_thread::yield();
+            ++rounds;
+        }
+        return rounds >= 0;
+    });
+    while (!started.load()) {
+        std::this_thread::yield();
+    }
+    running.cancel();
+    EXPECT_TRUE(polling.get());
+}
+
+TEST(CancellationTest, CancellingAGroupCascadesToNestedGroups) {
+    LockFreeThreadPool pool(2);
+    std::atomic<bool> inner_started{false};
+    std::atomic<bool> inner_saw_cancel{false};
+    std::atomic<int> skipped_ran{0};
+
+    TaskGroup outer(pool);
+    outer.run([&]() {
+        TaskGroup inner(pool);
+        inner.run([&]() {
+            inner_started = true;
+            while (!CancellationToken::current().is_cancelled()) {
+                std::this_thread::yield();
+            }
+            inner_saw_cancel = true;
+        });
+        while (!inner.is_cancelled()) {
+            std::this_thread::yield();
+        }
+        inner.run([&skipped_ran]() { skipped_ran++; });
+        inner.wait();
+    });
+
+    while (!inner_started.load()) {
+        std::this_thread::yield();
+    }
+    outer.cancel();
+    outer.wait();
+    EXPECT_TRUE(inner_saw_cancel.load());
+    EXPECT_EQ(skipped_ran.load(), 0);
+
+    // Explicit parents work across unrelated groups too.
+    CancellationSource request;
+    TaskGroup detached(pool, request.token());
+    request.cancel();
+    std::atomic<bool> ran{false};
+    detached.run([&ran]() { ran = true; });
+    detached.wait();
+    EXPECT_FALSE(ran.load());
+}
+
+// Writes a throwaway sysfs-like tree: files maps relative paths to contents.
+static std::string make_fake_sysfs(const std::map<std::string, std::string>& files) {
+    std::string root = ::testing::TempDir() + "fake_sysfs_XXXXXX";
+    if (!mkdtemp(&root[0])) {
+        return {};
+    }
+    for (const auto& [path, contents] : files) {
+        for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            mkdir((root + "/" + path.substr(0, slash)).c_str(), 0755);
+        }
+        std::ofstream(root + "/" + path) << contents;
+    }
+    return root;
+}
+
+TEST(TopologyTest, ParsesCpuLists) {
+    EXPECT_EQ(CpuTopology::parse_cpu_list("0-3,8,10-11\n"),
+              (std::vector<unsigned>{0, 1, 2, 3, 8, 10, 11}));
+    EXPECT_EQ(CpuTopology::parse_cpu_list("5"), (std::vector<unsigned>{5}));
+    EXPECT_TRUE(CpuTopology::parse_cpu_list("").empty());
+    EXPECT_TRUE(CpuTopology::parse_cpu_list("3-1").empty());
+    EXPECT_TRUE(CpuTopology::parse_cpu_list("x").empty());
+}
+
+TEST(TopologyTest, ReadsNodesFromSysfs) {
+    std::string root = make_fake_sysfs({
+        {"online", "0-2\n"},
+        {"node0/cpulist", "0-1,4-5\n"},
+        {"node1/cpulist", "\n"},  // memory-only node
+        {"node2/cpulist", "2-3,6-7\n"},
+    });
+    ASSERT_FALSE(root.empty());
+
+    CpuTopology topology = CpuTopology::from_sysfs(root);
+    ASSERT_EQ(topology.nodes.size(), 2u);
+    EXPECT_EQ(topology.nodes[0], (std::vector<unsigned>{0, 1, 4, 5}));
+    EXPECT_EQ(topology.nodes[1], (std::vector<unsigned>{2, 3, 6, 7}));
+    EXPECT_EQ(topology.cpu_count(), 8u);
+
+    CpuTopology missing = CpuTopology::from_sysfs(root + "/does-not-exist");
+    EXPECT_EQ(missing.nodes.size(), 1u);
+    EXPECT_FALSE(missing.nodes[0].empty());
+}
+
+TEST(TopologyTest, WorkersAreGroupedByNode) {
+    ThreadPoolOptions options;
+    options.topology.nodes = {{0, 1, 2, 3}, {4, 5, 6, 7}};
+
+    options.num_threads = 4;
+    {
+        LockFreeThreadPool pool(options);
+        EXPECT_EQ(pool.numa_node_count(), 2u);
+        EXPECT_EQ(pool.worker_numa_node(0), 0u);
+        EXPECT_EQ(pool.worker_numa_node(1), 0u);
+        EXPECT_EQ(pool.worker_numa_node(2), 1u);
+        EXPECT_EQ(pool.worker_numa_node(3), 1u);
+    }
+
+    // Fewer workers than nodes: only nodes with workers get queues.
+    options.num_threads = 1;
+    {
+        LockFreeThreadPool pool(options);
+        EXPECT_EQ(pool.numa_node_count(), 1u);
+        EXPECT_EQ(pool.enqueue([]() { return 3; }).get(), 3);
+    }
+}
+
+TEST(TopologyTest, TwoNodePoolRunsEverything) {
+    ThreadPoolOptions options;
+    options.num_threads = 4;
+    options.topology.nodes = {{0, 1}, {2, 3}};
+    LockFreeThreadPool pool(options);
+
+    std::atomic<int> count{0};
+    std::vector<TaskFuture<void>> futures;
+    for (int i = 0; i < 200; ++i) {
+        futures.push_back(pool.enqueue([&pool, &count]() {
+            pool.parallel_for(0, 50, [&count](int) { count++; });
+        }));
+    }
+    for (auto& future : futures) {
+        future.get();
+    }
+    pool.wait();
+    EXPECT_EQ(count.load(), 200 * 50);
+}
+
+TEST(TopologyTest, UnpinnedWorkersStayOnTheirNode) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || !CPU_ISSET(0, &allowed)) {
+        GTEST_SKIP() << "CPU 0 is not available to this process";
+    }
+
+    // Node 1's CPU does not exist, so only the worker on node 0 can be bound.
+    ThreadPoolOptions options;
+    options.num_threads = 2;
+    options.topology.nodes = {{0}, {1000}};
+    LockFreeThreadPool pool(options);
+    ASSERT_EQ(pool.numa_node_count(), 2u);
+    EXPECT_EQ(pool.worker_cpu(0), -1);
+
+    std::atomic<int> arrived{0};
+    std::atomic<int> bound_to_node0{0};
+    auto body = [&]() {
+        arrived.fetch_add(1);
+        while (arrived.load() < 2) {
+            std::this_thread::yield();
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1 && CPU_ISSET(0, &set)) {
+            bound_to_node0.fetch_add(1);
+        }
+    };
+    TaskFuture<void> first = pool.enqueue(body);
+    TaskFuture<void> second = pool.enqueue(body);
+    first.get();
+    second.get();
+    // With only CPU 0 allowed the unbound worker looks bound as well.
+    EXPECT_EQ(bound_to_node0.load(), CPU_COUNT(&allowed) > 1 ? 1 : 2);
+}
+
+TEST(PlacementTest, ReadsSiblingsFromSysfs) {
+    std::string root = make_fake_sysfs({
+        {"node/online", "0\n"},
+        {"node/node0/cpulist", "0-3\n"},
+        {"cpu/cpu0/topology/thread_siblings_list", "0,2\n"},
+        {"cpu/cpu1/topology/thread_siblings_list", "1,3\n"},
+        {"cpu/cpu2/topology/thread_siblings_list", "0,2\n"},
+        {"cpu/cpu3/topology/thread_siblings_list", "1,3\n"},
+    });
+    ASSERT_FALSE(root.empty());
+
+    CpuTopology topology = CpuTopology::from_sysfs(root + "/node", root + "/cpu");
+    EXPECT_EQ(topology.cores, (std::vector<std::vector<unsigned>>{{0, 2}, {1, 3}}));
+}
+
+TEST(PlacementTest, PoliciesOrderCpus) {
+    // Two nodes of two cores each, each core with two hardware threads.
+    CpuTopology topology;
+    topology.nodes = {{0, 1, 4, 5}, {2, 3, 6, 7}};
+    topology.cores = {{0, 4}, {1, 5}, {2, 6}, {3, 7}};
+
+    using Cpus = std::vector<unsigned>;
+    EXPECT_EQ(topology.place(ThreadPlacement::Compact, 8), (Cpus{0, 4, 1, 5, 2, 6, 3, 7}));
+    EXPECT_EQ(topology.place(ThreadPlacement::PhysicalCores, 4), (Cpus{0, 1, 2, 3}));
+    EXPECT_EQ(topology.place(ThreadPlacement::PhysicalCores, 6), (Cpus{0, 1, 2, 3, 0, 1}));
+    EXPECT_EQ(topology.place(ThreadPlacement::Scatter, 8), (Cpus{0, 2, 1, 3, 4, 6, 5, 7}));
+    EXPECT_EQ(topology.place(ThreadPlacement::Compact, 3), (Cpus{0, 4, 1}));
+    EXPECT_EQ(topology.place(ThreadPlacement::None, 2), (Cpus{0, 2}));
+
+    // Without sibling information every CPU is its own core.
+    topology.cores.clear();
+    EXPECT_EQ(topology.place(ThreadPlacement::PhysicalCores, 8), (Cpus{0, 1, 4, 5, 2, 3, 6, 7}));
+}
+
+TEST(PlacementTest, RestrictsTopologyToAllowedCpus) {
+    CpuTopology topology;
+    topology.nodes = {{0, 1, 4, 5}, {2, 3, 6, 7}};
+    topology.cores = {{0, 4}, {1, 5}, {2, 6}, {3, 7}};
+
+    CpuTopology allowed = topology.restricted_to({1, 2, 3, 5});
+    EXPECT_EQ(allowed.nodes, (std::vector<std::vector<unsigned>>{{1, 5}, {2, 3}}));
+    EXPECT_EQ(allowed.cores, (std::vector<std::vector<unsigned>>{{1, 5}, {2}, {3}}));
+
+    using Cpus = std::vector<unsigned>;
+    EXPECT_EQ(allowed.place(ThreadPlacement::Compact, 4), (Cpus{1, 5, 2, 3}));
+    EXPECT_EQ(allowed.place(ThreadPlacement::PhysicalCores, 3), (Cpus{1, 2, 3}));
+    EXPECT_EQ(allowed.place(ThreadPlacement::Scatter, 4), (Cpus{1, 2, 5, 3}));
+
+    EXPECT_EQ(topology.restricted_to({9}).nodes, (std::vector<std::vector<unsigned>>{{9}}));
+    EXPECT_EQ(topology.restricted_to({}).nodes, topology.nodes);
+}
+
+TEST(PlacementTest, PinsInsideARestrictedMask) {
+    std::vector<unsigned> cpus = CpuTopology::allowed_cpus();
+    ASSERT_FALSE(cpus.empty());
+    unsigned only = cpus.back();
+
+    // A pool made on a thread limited to one CPU, as under taskset, places
+    // every worker there.
+    std::thread restricted([only]() {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(only, &set);
+        ASSERT_EQ(sched_setaffinity(0, sizeof(set), &set), 0);
+        EXPECT_EQ(CpuTopology::allowed_cpus(), (std::vector<unsigned>{only}));
+
+        for (ThreadPlacement placement : {ThreadPlacement::Compact, ThreadPlacement::Scatter,
+                                          ThreadPlacement::PhysicalCores}) {
+            ThreadPoolOptions options;
+            options.num_threads = 2;
+            options.placement = placement;
+            LockFreeThreadPool pool(options);
+            EXPECT_EQ(pool.worker_cpu(0), static_cast<int>(only));
+            EXPECT_EQ(pool.worker_cpu(1), static_cast<int>(only));
+        }
+    });
+    restricted.join();
+}
+
+TEST(PlacementTest, WorkersArePinned) {
+    ThreadPoolOptions options;
+    options.num_threads = 2;
+    options.placement = ThreadPlacement::Explicit;
+    options.cpus = {0};
+    {
+        LockFreeThreadPool pool(options);
+        EXPECT_EQ(pool.worker_cpu(0), 0);
+        EXPECT_EQ(pool.worker_cpu(1), 0);
+        EXPECT_EQ(pool.enqueue([]() { return sched_getcpu(); }).get(), 0);
+    }
+
+    options.placement = ThreadPlacement::Compact;
+    {
+        LockFreeThreadPool pool(options);
+        EXPECT_GE(pool.worker_cpu(0), 0);
+        std::atomic<int> count{0};
+        pool.parallel_for(0, 100, [&count](int) { count++; });
+        EXPECT_EQ(count.load(), 100);
+    }
+
+    options.placement = ThreadPlacement::None;
+    {
+        LockFreeThreadPool pool(options);
+        EXPECT_EQ(pool.worker_cpu(0), -1);
+        EXPECT_EQ(pool.worker_cpu(1), -1);
+    }
+}
+
+TEST(CpuQuotaTest, ReadsCgroupV2Quota) {
+    std::string root = make_fake_sysfs({
+        {"self", "0::/kubepods/pod1/app\n"},
+        {"fs/cpu.max", "max 100000\n"},
+        {"fs/kubepods/pod1/cpu.max", "400000 100000\n"},
+        {"fs/kubepods/pod1/app/cpu.max", "max 100000\n"},
+    });
+    ASSERT_FALSE(root.empty());
+
+    // The quota of an ancestor applies to the whole subtree.
+    EXPECT_DOUBLE_EQ(CpuQuota::cgroup_limit(root + "/fs", root + "/self"), 4.0);
+
+    // Inside a container the listed path is not mounted; the root is.
+    std::string container = make_fake_sysfs({
+        {"self", "0::/docker/abc\n"},
+        {"fs/cpu.max", "150000 100000\n"},
+    });
+    EXPECT_DOUBLE_EQ(CpuQuota::cgroup_limit(container + "/fs", container + "/self"), 1.5);
+
+    std::string unlimited = make_fake_sysfs({
+        {"self", "0::/\n"},
+        {"fs/cpu.max", "max 100000\n"},
+    });
+    EXPECT_EQ(CpuQuota::cgroup_limit(unlimited + "/fs", unlimited + "/self"), 0.0);
+    EXPECT_EQ(CpuQuota::available(unlimited + "/fs", unlimited + "/self"), CpuQuota::affinity_cpus());
+}
+
+TEST(CpuQuotaTest, ReadsCgroupV1Quota) {
+    std::string root = make_fake_sysfs({
+        {"self", "12:memory:/docker/abc\n4:cpu,cpuacct:/docker/abc\n"},
+        {"fs/cpu,cpuacct/docker/abc/cpu.cfs_quota_us", "250000\n"},
+        {"fs/cpu,cpuacct/docker/abc/cpu.cfs_period_us", "100000\n"},
+        {"fs/cpu,cpuacct/cpu.cfs_quota_us", "-1\n"},
+        {"fs/cpu,cpuacct/cpu.cfs_period_us", "100000\n"},
+    });
+    ASSERT_FALSE(root.empty());
+    EXPECT_DOUBLE_EQ(CpuQuota::cgroup_limit(root + "/fs", root + "/self"), 2.5);
+}
+
+TEST(CpuQuotaTest, ToleratesPathsWithoutSlash) {
+    std::string root = make_fake_sysfs({
+        {"self", "0::docker\n4:cpu:abc\n"},
+        {"fs/docker/cpu.max", "200000 100000\n"},
+    });
+    ASSERT_FALSE(root.empty());
+
+    // The listed path itself is still read; the walk up just stops there.
+    double limit = -1;
+    EXPECT_NO_THROW(limit = CpuQuota::cgroup_limit(root + "/fs/", root + "/self"));
+    EXPECT_DOUBLE_EQ(limit, 2.0);
+    EXPECT_NO_THROW(CpuQuota::available(root + "/fs", root + "/self"));
+}
+
+TEST(CpuQuotaTest, QuotaCapsTheDefaultSize) {
+    std::string root = make_fake_sysfs({
+        {"self", "0::/\n"},
+        {"fs/cpu.max", "50000 100000\n"},
+    });
+    ASSERT_FALSE(root.empty());
+
+    // Half a CPU still gets one worker.
+    EXPECT_EQ(CpuQuota::available(root + "/fs", root + "/self"), 1u);
+
+    // Nothing readable: only the affinity mask counts.
+    EXPECT_EQ(CpuQuota::cgroup_limit(root + "/missing", root + "/missing"), 0.0);
+    EXPECT_EQ(CpuQuota::available(root + "/missing", root + "/missing"), CpuQuota::affinity_cpus());
+
+    EXPECT_GE(CpuQuota::detected(), 1u);
+    EXPECT_LE(CpuQuota::detected(), CpuQuota::affinity_cpus());
+    EXPECT_EQ(ThreadPoolOptions{}.num_threads, CpuQuota::detected());
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();